@@ -0,0 +1,228 @@
+#include "globals.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "block_reader.h"
+
+using namespace std;
+
+namespace
+{
+	const size_t npos = static_cast<size_t>(-1);
+
+	typedef void (*classifier)(const char* p, char separator, uint64_t& newlines, uint64_t& separators);
+
+	void classify_scalar(const char* p, char separator, uint64_t& newlines, uint64_t& separators)
+	{
+		newlines = 0;
+		separators = 0;
+		for (unsigned i(0); i < 64; ++i)
+		{
+			newlines |= static_cast<uint64_t>(p[i] == '\n') << i;
+			separators |= static_cast<uint64_t>(p[i] == separator) << i;
+		}
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	__attribute__((target("sse2")))
+	void classify_sse2(const char* p, char separator, uint64_t& newlines, uint64_t& separators)
+	{
+		const __m128i nl = _mm_set1_epi8('\n'), sep = _mm_set1_epi8(separator);
+		newlines = 0;
+		separators = 0;
+		for (unsigned i(0); i < 64; i += 16)
+		{
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+			newlines |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)))) << i;
+			separators |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, sep)))) << i;
+		}
+	}
+
+	__attribute__((target("avx2")))
+	void classify_avx2(const char* p, char separator, uint64_t& newlines, uint64_t& separators)
+	{
+		const __m256i nl = _mm256_set1_epi8('\n'), sep = _mm256_set1_epi8(separator);
+		__m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+		__m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+		newlines = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, nl))) |
+			static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, nl)))) << 32;
+		separators = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(low, sep))) |
+			static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(high, sep)))) << 32;
+	}
+#endif
+
+	classifier pick_classifier()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+			return classify_avx2;
+		if (__builtin_cpu_supports("sse2"))
+			return classify_sse2;
+#endif
+		return classify_scalar;
+	}
+
+	const classifier classify = pick_classifier();
+
+	// isspace() in the C locale, which is never changed, without the call.
+	inline bool space(char c)
+	{
+		return c == ' ' || (c >= '\t' && c <= '\r');
+	}
+	inline void trim(const char*& begin, const char*& end)
+	{
+		while (begin < end && space(*begin))
+			++begin;
+		while (end > begin && space(end[-1]))
+			--end;
+	}
+	inline bool closing(const char* begin, const char* end)
+	{
+		return end - begin == 1 && *begin == '}';
+	}
+}
+
+const size_t block_reader::buffer_size;
+
+block_reader::block_reader(istream& file, char separator) : _file(file), _separator(separator), _buffer(buffer_size + 64), _begin(0), _end(0), _window(npos), _newlines(0), _separators(0), _eof(false), _truncated(false) { }
+
+// Keeps [_begin, _end), moved to the front, and reads more after it.
+bool block_reader::refill()
+{
+	if (_eof)
+		return false;
+	if (_begin)
+	{
+		memmove(&_buffer[0], &_buffer[_begin], _end - _begin);
+		_end -= _begin;
+		_begin = 0;
+	}
+	if (_end == _buffer.size() - 64)
+		_buffer.resize(_buffer.size() * 2);
+	_window = npos;
+	streamsize n = _file.rdbuf()->sgetn(&_buffer[_end], _buffer.size() - 64 - _end);
+	if (n <= 0)
+	{
+		_eof = true;
+		return false;
+	}
+	_end += n;
+	return true;
+}
+
+bool block_reader::line(const char*& begin, const char*& end, const char*& separator)
+{
+	size_t from = _begin, found = npos;
+	for (; ; )
+	{
+		if (from >= _end)
+		{
+			size_t shift = _begin;
+			if (!refill())
+			{
+				if (_begin == _end)
+					return false;
+				// Last line, without a newline.
+				begin = &_buffer[_begin];
+				end = &_buffer[_end];
+				separator = found != npos ? &_buffer[found] : nullptr;
+				_begin = _end;
+				break;
+			}
+			from -= shift;
+			if (found != npos)
+				found -= shift;
+			continue;
+		}
+		size_t window = from & ~static_cast<size_t>(63);
+		if (window != _window)
+		{
+			classify(&_buffer[window], _separator, _newlines, _separators);
+			_window = window;
+		}
+		uint64_t mask = ~static_cast<uint64_t>(0) << (from - window);
+		if (_end - window < 64)
+			mask &= (static_cast<uint64_t>(1) << (_end - window)) - 1;
+		uint64_t newlines = _newlines & mask, separators = _separators & mask;
+		if (newlines)
+		{
+			size_t newline = window + __builtin_ctzll(newlines);
+			separators &= (static_cast<uint64_t>(1) << (newline - window)) - 1;
+			if (found == npos && separators)
+				found = window + __builtin_ctzll(separators);
+			begin = &_buffer[_begin];
+			end = &_buffer[newline];
+			separator = found != npos ? &_buffer[found] : nullptr;
+			_begin = newline + 1;
+			break;
+		}
+		if (found == npos && separators)
+			found = window + __builtin_ctzll(separators);
+		from = window + 64;
+	}
+	trim(begin, end);
+	// Objects are indented with the separator itself.
+	if (separator && separator < begin)
+		separator = static_cast<const char*>(memchr(begin, _separator, end - begin));
+	else if (separator >= end)
+		separator = nullptr;
+	return true;
+}
+
+bool block_reader::next_block(string& header)
+{
+	const char* begin;
+	const char* end;
+	const char* separator;
+	while (line(begin, end, separator))
+		if (end - begin > 2 && end[-1] == '{' && end[-2] == ' ')
+		{
+			header.assign(begin, end - 2);
+			return true;
+		}
+	return false;
+}
+
+bool block_reader::next_field(string& key, string& value)
+{
+	const char* begin;
+	const char* end;
+	const char* separator;
+	while (line(begin, end, separator))
+	{
+		if (closing(begin, end))
+			return false;
+		if (!separator)
+			continue;
+		const char* key_end = separator;
+		const char* value_begin = separator + 1;
+		trim(begin, key_end);
+		trim(value_begin, end);
+		key.assign(begin, key_end);
+		value.assign(value_begin, end);
+		return true;
+	}
+	_truncated = true;
+	return false;
+}
+
+void block_reader::skip_block()
+{
+	const char* begin;
+	const char* end;
+	const char* separator;
+	while (line(begin, end, separator))
+		if (closing(begin, end))
+			return;
+	_truncated = true;
+}
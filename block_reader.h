@@ -0,0 +1,56 @@
+#ifndef __BLOCK_READER_H
+#define __BLOCK_READER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+// Tokenizer for the block syntax shared by status.dat and objects.cache:
+//
+//	<header> {
+//		<key><separator><value>
+//		}
+//
+// Input is classified 64 bytes at a time into bitmasks of newlines and
+// separators (AVX2 or SSE2, picked at run time), so that every byte is
+// looked at once; lines and keys are then found by counting bits. Blocks
+// nobody wants are skipped without building strings.
+class block_reader
+{
+public:
+	static const std::size_t buffer_size = 1 << 18;
+
+private:
+	std::istream& _file;
+	char _separator;
+	std::vector<char> _buffer; // padded so that a window can always be loaded
+	std::size_t _begin;
+	std::size_t _end;
+	std::size_t _window; // offset of the classified window, or npos
+	std::uint64_t _newlines;
+	std::uint64_t _separators;
+	bool _eof;
+	bool _truncated;
+
+	bool refill();
+	// Next line as [begin, end) with the first separator in it, or nullptr,
+	// all trimmed of surrounding spaces.
+	bool line(const char*& begin, const char*& end, const char*& separator);
+
+public:
+	block_reader(std::istream& file, char separator);
+
+	// Moves past the header of the next block and gives it without " {".
+	bool next_block(std::string& header);
+	// Gives the next field of the current block, or false past its closing
+	// brace (or at the end of a truncated file).
+	bool next_field(std::string& key, std::string& value);
+	// Moves past the closing brace of the current block.
+	void skip_block();
+	// Whether the file ended within a block.
+	inline bool truncated() const { return _truncated; }
+};
+
+#endif
@@ -0,0 +1,219 @@
+#!/bin/sh
+# Checks for "make check": runs the binary on a status.dat, objects.cache
+# and logs written in a directory, as CGI, in watch mode and as a server
+# (-s), and looks for what its output has to hold. The server is checked
+# with curl, when found.
+#
+# Usage: check.sh binary directory
+
+binary=$1
+dir=$2
+if [ -z "$binary" ] || [ -z "$dir" ]; then
+	echo "Usage: $0 binary directory" >&2
+	exit 1
+fi
+mkdir -p "$dir" || exit 1
+
+# One host, h, with a CRITICAL service for each performance data given.
+write_status()
+{
+	printf 'define host {\n\thost_name\th\n\t}\n\n' > "$dir/objects.cache"
+	printf 'info {\n\tcreated=1700000000\n\t}\n\nhoststatus {\n\thost_name=h\n\tcurrent_state=0\n\t}\n\n' > "$dir/status.dat"
+	n=0
+	for perfdata in "$@"; do
+		printf 'servicestatus {\n\thost_name=h\n\tservice_description=s%d\n\tcurrent_state=2\n\tstate_type=1\n\tperformance_data=%s\n\tlast_state_change=%d\n\t}\n\n' $n "$perfdata" $((1700000000 + n)) >> "$dir/status.dat"
+		n=$((n + 1))
+	done
+}
+cat > "$dir/nagios-json.conf" <<EOF
+status-file=$dir/status.dat
+objects-file=$dir/objects.cache
+EOF
+
+failed=0
+# $dir/out has to contain $2, or not if $3 is "not", for check $1.
+verify()
+{
+	if grep -qF -- "$2" "$dir/out"; then
+		found=1
+	else
+		found=0
+	fi
+	if [ "$found" = "$([ "$3" = not ] && echo 0 || echo 1)" ]; then
+		echo "ok: $1"
+	else
+		echo "FAILED: $1: ${3:+$3 }expected $2 in" >&2
+		head -c 1000 "$dir/out" >&2
+		echo >&2
+		failed=1
+	fi
+}
+# The CGI output, headers included, for QUERY_STRING=$2 has to contain $3,
+# or not if $4 is "not". The binary reads $conf, with $cgi_env added to its
+# environment.
+conf=$dir/nagios-json.conf
+cgi_env=
+expect()
+{
+	env SERVER_PROTOCOL=HTTP/1.1 $cgi_env QUERY_STRING="$2" "$binary" "$conf" > "$dir/out" 2>&1
+	verify "$1" "$3" "$4"
+}
+
+# Exponents, which a unit does not take in, unless no digit follows.
+write_status 'load1=1.5e3;;;;' 't=1e-3s' 'a=1.5E+03' 'b=2e' 'c=1e+' 'd=1,5e2%'
+expect "1.5e3" "" '{"label":"load1","value":1500}'
+expect "1e-3s" "" '{"label":"t","uom":"s","value":0.001000}'
+expect "1.5E+03" "" '{"label":"a","value":1500}'
+expect "2e, unit e" "" '{"label":"b","uom":"e","value":2}'
+expect "1e+, unit e+" "" '{"label":"c","uom":"e+","value":1}'
+expect "1,5e2%" "" '{"label":"d","maximum":100,"minimum":0,"uom":"%","value":150}'
+
+# Six problems, the latest change the worst; limit is capped, not trusted.
+expect "problems, limit 2" "problems&limit=2" '"service_description":"s4","state_type":1}],"total":6}'
+expect "problems, limit 2 leaves s3 out" "problems&limit=2" '"s3"' not
+expect "problems, oversized limit" "problems&limit=100000000000" '"service_description":"s0","state_type":1}],"total":6}'
+expect "problems, limit past ULONG_MAX" "problems&limit=100000000000000000000000" '"total":6}'
+expect "problems, limit not a number" "problems&limit=abc" 'Status: 400 Bad Request'
+expect "problems, negative limit" "problems&limit=-1" 'Status: 400 Bad Request'
+expect "page, limit not a number" "limit=1x" 'Status: 400 Bad Request'
+
+# Content negotiation: a weight of 0 refuses a type, wildcards included.
+cgi_env="HTTP_ACCEPT=application/json;q=0,application/cbor"
+expect "Accept, JSON refused" "summary" 'Content-Type: application/cbor'
+cgi_env="HTTP_ACCEPT=application/json;q=0,*/*"
+expect "Accept, JSON refused, */*" "summary" 'Content-Type: application/json' not
+cgi_env="HTTP_ACCEPT=application/cbor;aq=0"
+expect "Accept, a parameter ending in q" "summary" 'Content-Type: application/cbor'
+cgi_env="HTTP_ACCEPT=application/json;q=0.5,application/cbor;q=2"
+expect "Accept, invalid weight" "summary" 'Content-Type: application/json'
+cgi_env=
+
+# Hosts a0 to a2 and b0, for users: alice sees the hosts named a..., by
+# the rest of their name, bob those whose alias starts with web. Alerts of
+# a1 and b0 are logged, one of a1 in an archive.
+mkdir -p "$dir/users/archives" "$dir/users/index" || exit 1
+: > "$dir/users/objects.cache"
+printf 'info {\n\tcreated=1700000000\n\t}\n\n' > "$dir/users/status.dat"
+for host in "a0 web" "a1 db" "a2 web" "b0 web"; do
+	set -- $host
+	printf 'define host {\n\thost_name\t%s\n\talias\t%s %s\n\t}\n\n' $1 $2 $1 >> "$dir/users/objects.cache"
+	printf 'hoststatus {\n\thost_name=%s\n\tcurrent_state=0\n\t}\n\nservicestatus {\n\thost_name=%s\n\tservice_description=s0\n\tcurrent_state=2\n\tstate_type=1\n\tperformance_data=load1=1\n\tlast_state_change=1700000000\n\t}\n\n' $1 $1 >> "$dir/users/status.dat"
+done
+printf '[1699990000] SERVICE ALERT: a1;s0;CRITICAL;HARD;1;old\n' > "$dir/users/archives/nagios-11-14-2023-00.log"
+printf '[1700000000] SERVICE ALERT: a1;s0;CRITICAL;HARD;1;down\n[1700000100] SERVICE ALERT: a1;s0;OK;HARD;1;up\n[1700000200] HOST ALERT: b0;DOWN;HARD;1;gone\n' > "$dir/users/nagios.log"
+cat > "$dir/users/nagios-json.conf" <<EOF
+status-file=$dir/users/status.dat
+objects-file=$dir/users/objects.cache
+log-file=$dir/users/nagios.log
+log-archive-dir=$dir/users/archives
+log-index-dir=$dir/users/index
+users.alice.host-prefix=a
+users.bob.alias-prefix=web
+EOF
+conf=$dir/users/nagios-json.conf
+
+# Cursors hold names as the user sees them, base64url encoded: "0" is MA.
+cgi_env=REMOTE_USER=alice
+expect "cursor, without the host prefix" "limit=1" '"host_name":"0"'
+expect "cursor, next" "limit=1" '"next":"MA"'
+expect "cursor, next page" "limit=1&after=MA" '"host_name":"1"'
+expect "cursor, last page" "limit=5&after=MQ" '"host_name":"2"'
+expect "cursor, not past the prefix" "limit=5&after=MQ" '"b0"' not
+expect "cursor, past the last host" "limit=5&after=Mg" '{"hosts":[]}'
+cgi_env=REMOTE_USER=bob
+expect "alias prefix, hidden host" "limit=5" '"a1"' not
+expect "alias prefix, visible host" "limit=5" '"host_name":"b0"'
+
+# ?events names logs, not paths, and only for hosts the user sees.
+cgi_env=
+expect "events, current log" "events" '"current":{"alerts":3,'
+expect "events, archive by date" "events" '"2023-11-14-00":{"alerts":1,'
+expect "events, no file name" "events" '.log"' not
+cgi_env=REMOTE_USER=alice
+expect "events, host prefix" "events&host=1&start=1699000000&end=1800000000" '"output":"old"'
+expect "events, latest in limit" "events&host=1&start=1699000000&end=1800000000&limit=1" '[{"attempt":1,"output":"up",'
+expect "events, limit not a number" "events&host=1&limit=abc" 'Status: 400 Bad Request'
+expect "events, other prefix" "events&host=b0&start=1699000000&end=1800000000" '"gone"' not
+cgi_env=REMOTE_USER=bob
+expect "events, hidden host" "events&host=a1" 'Status: 404 Not Found'
+cgi_env=
+
+# The watch mode publishes the snapshot image and records the history,
+# which CGI processes then read, as long as they are valid.
+cat "$dir/users/nagios-json.conf" - > "$dir/users/watch.conf" <<EOF
+snapshot-file=$dir/users/image
+history-file=$dir/users/history
+history-metrics=16
+history-samples=4
+EOF
+conf=$dir/users/watch.conf
+rm -f "$dir/users/image" "$dir/users/history"
+"$binary" -w "$conf" 2> /dev/null &
+watcher=$!
+i=0
+while [ ! -s "$dir/users/image" ] && [ $i -lt 100 ]; do
+	sleep 0.1
+	i=$((i + 1))
+done
+sleep 0.5
+kill $watcher
+wait $watcher 2> /dev/null
+cgi_env=REMOTE_USER=alice
+expect "image, host prefix" "limit=1" '"host_name":"0"'
+expect "history, host prefix" "history&host=0&service=s0&label=load1&start=1600000000&end=2000000000&buckets=1" '"average":1,"count":1,'
+cgi_env=REMOTE_USER=bob
+expect "history, hidden host" "history&host=a1&service=s0&label=load1" 'Status: 404 Not Found'
+cgi_env=
+sed 's/NJSNAP/NJSNAQ/' "$dir/users/image" > "$dir/users/image.tmp" && mv "$dir/users/image.tmp" "$dir/users/image"
+expect "image, other version" "limit=1" '"host_name":"a0"'
+head -c 100 "$dir/users/image" > "$dir/users/image.tmp" && mv "$dir/users/image.tmp" "$dir/users/image"
+expect "image, truncated" "limit=1" '"host_name":"a0"'
+head -c 100 "$dir/users/history" > "$dir/users/history.tmp" && mv "$dir/users/history.tmp" "$dir/users/history"
+expect "history, truncated" "history" 'Status: 503 Service Unavailable'
+
+# The server (-s) for the same hosts, over a UNIX socket, responses as
+# curl gets them, headers included.
+if command -v curl > /dev/null; then
+	{ cat "$dir/users/nagios-json.conf"; echo "listen=unix:$dir/server.sock"; echo "remote-user-header=x-user"; } > "$dir/users/server.conf"
+	rm -f "$dir/server.sock"
+	"$binary" -s "$dir/users/server.conf" > /dev/null 2>&1 &
+	server=$!
+	i=0
+	while [ ! -S "$dir/server.sock" ] && [ $i -lt 100 ]; do
+		sleep 0.1
+		i=$((i + 1))
+	done
+	fetch()
+	{
+		curl -s -i --max-time 10 --unix-socket "$dir/server.sock" "$@" > "$dir/out" 2>&1
+	}
+	fetch 'http://localhost/?summary'
+	verify "server, summary" 'HTTP/1.1 200 OK'
+	fetch 'http://localhost/?limit=abc'
+	verify "server, limit not a number" 'HTTP/1.1 400 Bad Request'
+	fetch 'http://localhost/?events&host=a1&limit=-1'
+	verify "server, events limit not a number" 'HTTP/1.1 400 Bad Request'
+	fetch -X POST 'http://localhost/'
+	verify "server, POST" 'HTTP/1.1 405 Method Not Allowed'
+	fetch -H 'Content-Length: 100000' 'http://localhost/'
+	verify "server, body too large" 'HTTP/1.1 413 Payload Too Large'
+	{ printf 'X-Pad: '; head -c 100000 /dev/zero | tr '\0' p; echo; } > "$dir/pad"
+	fetch -H @"$dir/pad" 'http://localhost/'
+	verify "server, headers too large" 'HTTP/1.1 431 Request Header Fields Too Large'
+	fetch -H 'x-user: alice' 'http://localhost/?limit=1&after=MA'
+	verify "server, cursor" '"hosts":[{"alias":"db a1","host_name":"1",'
+	fetch -H 'x-user: bob' 'http://localhost/?events&host=a1'
+	verify "server, events of a hidden host" 'HTTP/1.1 404 Not Found'
+	fetch 'http://localhost/?summary' 'http://localhost/?stats'
+	verify "server, keep-alive" '"requests":'
+	fetch 'http://localhost/?summary'
+	verify "server, still up" 'HTTP/1.1 200 OK'
+	kill $server
+	wait $server 2> /dev/null
+	rm -f "$dir/server.sock" "$dir/pad"
+else
+	echo "curl not found, server not checked" >&2
+fi
+
+rm -f "$dir/out"
+exit $failed
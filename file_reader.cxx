@@ -0,0 +1,289 @@
+#include "globals.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "file_reader.h"
+
+using namespace std;
+
+namespace
+{
+	// Reads length bytes at offset, or up to the end of the file.
+	long read_fully(int fd, char* data, size_t length, off_t offset)
+	{
+		size_t done = 0;
+		while (done < length)
+		{
+			ssize_t n = pread(fd, data + done, length - done, offset + done);
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				break;
+			done += n;
+		}
+		return static_cast<long>(done);
+	}
+}
+
+// Submission and completion queues shared with the kernel. There is no
+// liburing here: the queues are mapped and driven by hand.
+struct file_reader::ring
+{
+	int fd;
+	void* queues;
+	size_t queues_size;
+	io_uring_sqe* sqes;
+	size_t sqes_size;
+	unsigned* sq_tail;
+	unsigned sq_mask;
+	unsigned* sq_array;
+	unsigned* cq_head;
+	unsigned* cq_tail;
+	unsigned cq_mask;
+	io_uring_cqe* cqes;
+	unsigned pending; // queued but not yet submitted
+	unsigned in_flight;
+
+	ring() : fd(-1), queues(MAP_FAILED), queues_size(0), sqes(static_cast<io_uring_sqe*>(MAP_FAILED)), sqes_size(0), pending(0), in_flight(0) { }
+	~ring()
+	{
+		if (sqes != MAP_FAILED)
+			munmap(sqes, sqes_size);
+		if (queues != MAP_FAILED)
+			munmap(queues, queues_size);
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool setup(unsigned entries)
+	{
+		io_uring_params p;
+		memset(&p, 0, sizeof(p));
+		fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+		if (fd < 0 || !(p.features & IORING_FEAT_SINGLE_MMAP))
+			return false;
+		size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+		size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+		queues_size = sq_size > cq_size ? sq_size : cq_size;
+		queues = mmap(nullptr, queues_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if (queues == MAP_FAILED)
+			return false;
+		sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+		sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+		if (sqes == MAP_FAILED)
+			return false;
+		char* base = static_cast<char*>(queues);
+		sq_tail = reinterpret_cast<unsigned*>(base + p.sq_off.tail);
+		sq_mask = *reinterpret_cast<unsigned*>(base + p.sq_off.ring_mask);
+		sq_array = reinterpret_cast<unsigned*>(base + p.sq_off.array);
+		cq_head = reinterpret_cast<unsigned*>(base + p.cq_off.head);
+		cq_tail = reinterpret_cast<unsigned*>(base + p.cq_off.tail);
+		cq_mask = *reinterpret_cast<unsigned*>(base + p.cq_off.ring_mask);
+		cqes = reinterpret_cast<io_uring_cqe*>(base + p.cq_off.cqes);
+		return true;
+	}
+
+	void read(int file_fd, char* data, size_t length, off_t offset, uint64_t user_data)
+	{
+		unsigned tail = *sq_tail;
+		unsigned i = tail & sq_mask;
+		io_uring_sqe& sqe = sqes[i];
+		memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_READ;
+		sqe.fd = file_fd;
+		sqe.addr = reinterpret_cast<uint64_t>(data);
+		sqe.len = static_cast<uint32_t>(length);
+		sqe.off = offset;
+		sqe.user_data = user_data;
+		sq_array[i] = i;
+		__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+		++pending;
+		++in_flight;
+	}
+
+	bool enter(unsigned wait)
+	{
+		for (; ; )
+		{
+			long r = syscall(__NR_io_uring_enter, fd, pending, wait, wait ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+			if (r >= 0)
+			{
+				pending -= static_cast<unsigned>(r);
+				return true;
+			}
+			if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+				return false;
+		}
+	}
+};
+
+const size_t file_reader::chunk_size;
+const unsigned file_reader::depth;
+
+file_reader::file_reader(const vector<string>& paths) : _files(), _ring(new ring()), _threads(), _mutex(), _changed(), _stopping(false)
+{
+	vector<string>::size_type count = paths.size();
+	for (vector<string>::size_type i(0); i < count; ++i)
+	{
+		_files.emplace_back(new file(*this, i));
+		file& f = *_files.back();
+		f.fd = ::open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+		struct stat st;
+		if (f.fd < 0 || fstat(f.fd, &st) != 0)
+			continue;
+		f.chunks = (st.st_size + chunk_size - 1) / chunk_size;
+		f.data.resize((f.chunks < depth ? f.chunks : depth) * chunk_size);
+		posix_fadvise(f.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+	if (_ring->setup(count * depth))
+	{
+		for (vector<string>::size_type i(0); i < count; ++i)
+			while (_files[i]->submitted < _files[i]->chunks && _files[i]->submitted < depth)
+				queue(i);
+		if (!_ring->pending || _ring->enter(0))
+			return;
+		for (vector<string>::size_type i(0); i < count; ++i)
+			_files[i]->submitted = 0;
+	}
+	_ring.reset();
+	for (vector<string>::size_type i(0); i < count; ++i)
+		_threads.emplace_back(&file_reader::fetch, this, i);
+}
+
+file_reader::~file_reader()
+{
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_changed.notify_all();
+	for (vector<thread>::iterator it = _threads.begin(); it != _threads.end(); ++it)
+		it->join();
+	// The kernel may still be writing into the chunks.
+	while (_ring && _ring->in_flight && reap(true))
+		;
+	vector<unique_ptr<file> >::iterator end = _files.end();
+	for (vector<unique_ptr<file> >::iterator it = _files.begin(); it != end; ++it)
+		if ((*it)->fd >= 0)
+			close((*it)->fd);
+}
+
+void file_reader::queue(size_t index)
+{
+	file& f = *_files[index];
+	size_t chunk = f.submitted++;
+	char* data = &f.data[(chunk % depth) * chunk_size];
+	_ring->read(f.fd, data, chunk_size, static_cast<off_t>(chunk) * chunk_size, static_cast<uint64_t>(index) << 32 | chunk);
+}
+
+// Short or failed reads are finished synchronously, so that a kernel
+// lacking IORING_OP_READ still gives the right result.
+void file_reader::complete(size_t index, size_t chunk, long result)
+{
+	file& f = *_files[index];
+	char* data = &f.data[(chunk % depth) * chunk_size];
+	off_t offset = static_cast<off_t>(chunk) * chunk_size;
+	if (result < 0)
+		result = read_fully(f.fd, data, chunk_size, offset);
+	else if (static_cast<size_t>(result) < chunk_size && chunk + 1 < f.chunks)
+		result += read_fully(f.fd, data + result, chunk_size - result, offset + result);
+	f.lengths[chunk % depth] = result;
+}
+
+bool file_reader::reap(bool wait)
+{
+	if ((_ring->pending || wait) && !_ring->enter(wait ? 1 : 0))
+		return false;
+	unsigned head = *_ring->cq_head;
+	unsigned tail = __atomic_load_n(_ring->cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; ++head)
+	{
+		const io_uring_cqe& cqe = _ring->cqes[head & _ring->cq_mask];
+		--_ring->in_flight;
+		if (!_stopping)
+			complete(static_cast<size_t>(cqe.user_data >> 32), static_cast<size_t>(cqe.user_data & 0xffffffffu), cqe.res);
+	}
+	__atomic_store_n(_ring->cq_head, head, __ATOMIC_RELEASE);
+	return true;
+}
+
+void file_reader::fetch(size_t index)
+{
+	file& f = *_files[index];
+	for (size_t chunk(0); chunk < f.chunks; ++chunk)
+	{
+		{
+			unique_lock<mutex> lock(_mutex);
+			while (!_stopping && chunk >= f.consumed + depth)
+				_changed.wait(lock);
+			if (_stopping)
+				return;
+		}
+		long result = read_fully(f.fd, &f.data[(chunk % depth) * chunk_size], chunk_size, static_cast<off_t>(chunk) * chunk_size);
+		{
+			lock_guard<mutex> lock(_mutex);
+			f.lengths[chunk % depth] = result;
+		}
+		_changed.notify_all();
+	}
+}
+
+bool file_reader::next(size_t index, char*& begin, char*& end)
+{
+	file& f = *_files[index];
+	unique_lock<mutex> lock(_mutex);
+	if (f.started)
+	{
+		// Done with the chunk the stream was on, read further into it.
+		f.lengths[f.consumed++ % depth] = -1;
+		if (_ring)
+		{
+			if (f.submitted < f.chunks)
+				queue(index);
+		}
+		else
+			_changed.notify_all();
+	}
+	if (f.consumed >= f.chunks)
+		return false;
+	f.started = true;
+	long& length = f.lengths[f.consumed % depth];
+	while (length < 0)
+	{
+		if (!_ring)
+			_changed.wait(lock);
+		else if (!reap(true))
+			complete(index, f.consumed, -1);
+	}
+	begin = &f.data[(f.consumed % depth) * chunk_size];
+	end = begin + length;
+	return true;
+}
+
+file_reader::buffer::int_type file_reader::buffer::underflow()
+{
+	char* begin;
+	char* end;
+	do
+	{
+		if (!_reader.next(_file, begin, end))
+			return traits_type::eof();
+		setg(begin, begin, end);
+	} while (begin == end);
+	return traits_type::to_int_type(*begin);
+}
@@ -0,0 +1,78 @@
+#ifndef __FILE_READER_H
+#define __FILE_READER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads several files front to back in large chunks, keeping a few reads of
+// every file in flight from the start, so that the disk fetches all of them
+// while the caller parses the first. Reads go through io_uring when the
+// kernel offers it, through one thread per file calling pread() otherwise.
+// Each file is consumed as an istream; a chunk is read again into as soon
+// as the stream has moved past it.
+class file_reader
+{
+public:
+	static const std::size_t chunk_size = 1 << 20;
+	static const unsigned depth = 4;
+
+private:
+	struct ring;
+
+	class buffer : public std::streambuf
+	{
+	private:
+		file_reader& _reader;
+		std::size_t _file;
+
+	protected:
+		int_type underflow();
+
+	public:
+		buffer(file_reader& reader, std::size_t file) : _reader(reader), _file(file) { }
+	};
+
+	struct file
+	{
+		int fd;
+		std::size_t chunks;
+		std::size_t submitted; // chunks whose read was issued
+		std::size_t consumed; // chunks the stream is done with
+		bool started;
+		std::vector<char> data; // depth chunks
+		std::vector<long> lengths; // per chunk of data, -1 while being read
+		buffer buf;
+		std::istream stream;
+
+		file(file_reader& reader, std::size_t index) : fd(-1), chunks(0), submitted(0), consumed(0), started(false), data(), lengths(depth, -1), buf(reader, index), stream(&buf) { }
+	};
+
+	std::vector<std::unique_ptr<file> > _files;
+	std::unique_ptr<ring> _ring;
+	std::vector<std::thread> _threads;
+	std::mutex _mutex;
+	std::condition_variable _changed;
+	bool _stopping;
+
+	void queue(std::size_t index);
+	void complete(std::size_t index, std::size_t chunk, long result);
+	bool reap(bool wait);
+	void fetch(std::size_t index);
+	// Waits for the next chunk of a file, after giving back the current one.
+	bool next(std::size_t index, char*& begin, char*& end);
+
+public:
+	explicit file_reader(const std::vector<std::string>& paths);
+	~file_reader();
+
+	inline std::istream& stream(std::size_t index) { return _files[index]->stream; }
+};
+
+#endif
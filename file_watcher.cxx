@@ -0,0 +1,85 @@
+#include "globals.h"
+
+#include <cerrno>
+#include <chrono>
+#include <map>
+#include <set>
+#include <string>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "file_watcher.h"
+
+using namespace std;
+
+file_watcher::file_watcher() : _fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)), _directories(), _files() { }
+
+file_watcher::~file_watcher()
+{
+	if (_fd >= 0)
+		close(_fd);
+}
+
+bool file_watcher::add(const string& path)
+{
+	string::size_type slash = path.rfind('/');
+	string directory(slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash)));
+	int wd = inotify_add_watch(_fd, directory.c_str(), IN_MOVED_TO | IN_CLOSE_WRITE);
+	if (wd < 0)
+		return false;
+	if (directory != "/")
+		directory.push_back('/');
+	_directories[wd] = directory;
+	_files.insert(slash == string::npos ? "./" + path : path);
+	return true;
+}
+
+bool file_watcher::drain()
+{
+	bool changed = false;
+	alignas(struct inotify_event) char buf[4096];
+	ssize_t len;
+	while ((len = read(_fd, buf, sizeof(buf))) > 0)
+	{
+		for (char* p = buf; p < buf + len; )
+		{
+			const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+			map<int, string>::const_iterator dir = _directories.find(event->wd);
+			if (event->len && dir != _directories.end() && _files.count(dir->second + event->name))
+				changed = true;
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+	return changed;
+}
+
+bool file_watcher::wait(int quiet_ms, int max_ms)
+{
+	struct pollfd pfd;
+	pfd.fd = _fd;
+	pfd.events = POLLIN;
+	for (; ; )
+	{
+		int r = poll(&pfd, 1, -1);
+		if (r < 0 && errno != EINTR)
+			return false;
+		if (r > 0 && drain())
+			break;
+	}
+	chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(max_ms);
+	for (; ; )
+	{
+		int left = static_cast<int>(chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count());
+		if (left <= 0)
+			return true;
+		int r = poll(&pfd, 1, quiet_ms < left ? quiet_ms : left);
+		if (r == 0)
+			return true;
+		if (r < 0 && errno != EINTR)
+			return false;
+		if (r > 0)
+			drain();
+	}
+}
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef __FILE_WATCHER_H
+#define __FILE_WATCHER_H
+
+#include <map>
+#include <set>
+#include <string>
+
+// Watches the directories containing a set of files through inotify, since
+// Nagios replaces status.dat by renaming a temporary file over it.
+class file_watcher
+{
+private:
+	int _fd;
+	std::map<int, std::string> _directories;
+	std::set<std::string> _files;
+
+public:
+	file_watcher();
+	~file_watcher();
+
+	inline bool valid() const { return _fd >= 0; }
+	// For callers polling it along with other descriptors, then calling
+	// drain() rather than wait().
+	inline int fd() const { return _fd; }
+
+	bool add(const std::string& path);
+	// Blocks until a watched file was written or moved into place, then until
+	// no further event arrived for quiet_ms (or at most max_ms overall), so
+	// that a burst of writes triggers a single reload.
+	bool wait(int quiet_ms, int max_ms);
+	// Consumes pending events, returns whether one concerned a watched file.
+	bool drain();
+};
+
+#endif
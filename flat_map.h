@@ -0,0 +1,158 @@
+#ifndef __FLAT_MAP_H
+#define __FLAT_MAP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "strutil.h"
+
+// Values are kept in one dense vector, looked up through an open-addressing
+// (linear probing) index on their key. Call sort() once ingestion is over to
+// iterate in the same order as a std::map<std::string, T> would.
+template<typename T, const std::string& (T::*Key)() const>
+class flat_map
+{
+public:
+	typedef std::vector<T> vector_type;
+	typedef typename vector_type::size_type size_type;
+	typedef typename vector_type::iterator iterator;
+	typedef typename vector_type::const_iterator const_iterator;
+
+	static const size_type npos = static_cast<size_type>(-1);
+
+private:
+	struct slot
+	{
+		std::uint32_t hash;
+		std::uint32_t position; // 0 for an empty slot, position + 1 otherwise
+	};
+
+	vector_type _values;
+	std::vector<std::uint32_t> _hashes;
+	std::vector<slot> _slots;
+	bool _sorted;
+
+	inline static const std::string& key_of(const T& value) { return (value.*Key)(); }
+
+	void place(std::uint32_t hash, size_type position)
+	{
+		size_type mask = _slots.size() - 1;
+		size_type i = hash & mask;
+		while (_slots[i].position)
+			i = (i + 1) & mask;
+		_slots[i].hash = hash;
+		_slots[i].position = static_cast<std::uint32_t>(position + 1);
+	}
+	void reindex(size_type capacity)
+	{
+		_slots.assign(capacity, slot());
+		size_type size = _values.size();
+		for (size_type i(0); i < size; ++i)
+			place(_hashes[i], i);
+	}
+
+public:
+	flat_map() : _values(), _hashes(), _slots(16, slot()), _sorted(true) { }
+
+	inline size_type size() const { return _values.size(); }
+	inline bool empty() const { return _values.empty(); }
+
+	inline iterator begin() { return _values.begin(); }
+	inline const_iterator begin() const { return _values.begin(); }
+	inline iterator end() { return _values.end(); }
+	inline const_iterator end() const { return _values.end(); }
+
+	inline T& operator [](size_type position) { return _values[position]; }
+	inline const T& operator [](size_type position) const { return _values[position]; }
+
+	inline bool sorted() const { return _sorted; }
+
+	size_type find(const std::string& key) const
+	{
+		std::uint32_t hash = static_cast<std::uint32_t>(hash_string(key));
+		size_type mask = _slots.size() - 1;
+		for (size_type i = hash & mask; _slots[i].position; i = (i + 1) & mask)
+		{
+			const slot& s = _slots[i];
+			if (s.hash == hash && key_of(_values[s.position - 1]) == key)
+				return s.position - 1;
+		}
+		return npos;
+	}
+
+	// Position of the first value whose key is not less than (lower_bound)
+	// or greater than (upper_bound) key. Only meaningful once sorted.
+	size_type lower_bound(const std::string& key) const
+	{
+		return std::lower_bound(_values.begin(), _values.end(), key, [](const T& value, const std::string& k) { return key_of(value) < k; }) - _values.begin();
+	}
+	size_type upper_bound(const std::string& key) const
+	{
+		return std::upper_bound(_values.begin(), _values.end(), key, [](const std::string& k, const T& value) { return k < key_of(value); }) - _values.begin();
+	}
+
+	// Returns the position of the value stored under key, appending T(key)
+	// first if there is none.
+	size_type insert(const std::string& key)
+	{
+		std::uint32_t hash = static_cast<std::uint32_t>(hash_string(key));
+		size_type mask = _slots.size() - 1;
+		size_type i = hash & mask;
+		for (; _slots[i].position; i = (i + 1) & mask)
+		{
+			const slot& s = _slots[i];
+			if (s.hash == hash && key_of(_values[s.position - 1]) == key)
+				return s.position - 1;
+		}
+		size_type position = _values.size();
+		if (_sorted && position && !(key_of(_values[position - 1]) < key))
+			_sorted = false;
+		_values.emplace_back(key);
+		_hashes.push_back(hash);
+		if ((position + 1) * 2 > _slots.size())
+			reindex(_slots.size() * 2);
+		else
+		{
+			_slots[i].hash = hash;
+			_slots[i].position = static_cast<std::uint32_t>(position + 1);
+		}
+		return position;
+	}
+
+	// Reorders the values by key. The returned vector holds, for each new
+	// position, the position the value had before, so that callers can apply
+	// the same permutation to parallel arrays.
+	std::vector<size_type> sort()
+	{
+		size_type size = _values.size();
+		std::vector<size_type> order(size);
+		for (size_type i(0); i < size; ++i)
+			order[i] = i;
+		if (_sorted)
+			return order;
+		const vector_type& values = _values;
+		std::sort(order.begin(), order.end(), [&values](size_type a, size_type b) { return key_of(values[a]) < key_of(values[b]); });
+		vector_type sorted_values;
+		std::vector<std::uint32_t> sorted_hashes;
+		sorted_values.reserve(size);
+		sorted_hashes.reserve(size);
+		for (size_type i(0); i < size; ++i)
+		{
+			sorted_values.push_back(std::move(_values[order[i]]));
+			sorted_hashes.push_back(_hashes[order[i]]);
+		}
+		_values.swap(sorted_values);
+		_hashes.swap(sorted_hashes);
+		reindex(_slots.size());
+		_sorted = true;
+		return order;
+	}
+};
+
+template<typename T, const std::string& (T::*Key)() const>
+const typename flat_map<T, Key>::size_type flat_map<T, Key>::npos;
+
+#endif
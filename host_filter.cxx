@@ -0,0 +1,92 @@
+#include "globals.h"
+
+#include <map>
+#include <string>
+
+#include "host_filter.h"
+#include "json.h"
+#include "nagios_host.h"
+#include "string_map.h"
+#include "strutil.h"
+
+using namespace std;
+
+host_filter host_filter::for_user(string_map& configuration, const string& user)
+{
+	return host_filter(
+		configuration["users." + user + ".host-prefix"],
+		configuration["users." + user + ".alias-prefix"],
+		configuration["users." + user + ".display-prefix"]);
+}
+
+string host_filter::key() const
+{
+	return _host_prefix + "\n" + _alias_prefix + "\n" + _display_prefix;
+}
+
+string host_filter::strip(const string& value, const string& prefix)
+{
+	string stripped(value.substr(prefix.size()));
+	trim(stripped);
+	return stripped;
+}
+
+bool host_filter::within(const string& host_prefix, host_filter& filter) const
+{
+	filter = *this;
+	if (starts_with(_host_prefix, host_prefix))
+		filter._host_prefix.erase(0, host_prefix.size());
+	else if (starts_with(host_prefix, _host_prefix))
+		filter._host_prefix.clear();
+	else
+		return false;
+	return true;
+}
+
+bool host_filter::visible(const nagios_host& host) const
+{
+	return (!_host_prefix.size() || starts_with(host.host_name(), _host_prefix)) &&
+		(!_alias_prefix.size() || starts_with(host.alias(), _alias_prefix)) &&
+		(!_display_prefix.size() || starts_with(host.display_name(), _display_prefix));
+}
+bool host_filter::matches(const nagios_host& host) const
+{
+	return host.services().size() && visible(host);
+}
+
+string host_filter::host_name(const nagios_host& host) const
+{
+	return _host_prefix.size() ? strip(host.host_name(), _host_prefix) : host.host_name();
+}
+string host_filter::alias(const nagios_host& host) const
+{
+	return _alias_prefix.size() ? strip(host.alias(), _alias_prefix) : host.alias();
+}
+string host_filter::display_name(const nagios_host& host) const
+{
+	return _display_prefix.size() ? strip(host.display_name(), _display_prefix) : host.display_name();
+}
+json host_filter::apply(const nagios_host& host) const
+{
+	json j(host);
+	map<string, json>& map(j.map_value());
+	if (_host_prefix.size())
+		map["host_name"].string_value() = host_name(host);
+	if (_alias_prefix.size())
+	{
+		string alias(this->alias(host));
+		if (alias.size())
+			map["alias"].string_value() = alias;
+		else
+			map.erase("alias");
+	}
+	if (_display_prefix.size())
+	{
+		string display_name(this->display_name(host));
+		if (display_name.size())
+			map["display_name"].string_value() = display_name;
+		else
+			map.erase("display_name");
+	}
+	return j;
+}
\ No newline at end of file
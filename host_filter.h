@@ -0,0 +1,51 @@
+#ifndef __HOST_FILTER_H
+#define __HOST_FILTER_H
+
+#include <string>
+
+#include "json.h"
+#include "nagios_host.h"
+#include "string_map.h"
+
+// Restricts the hosts a user sees to those whose name, alias and display
+// name start with the configured prefixes, which are stripped on output.
+class host_filter
+{
+private:
+	std::string _host_prefix;
+	std::string _alias_prefix;
+	std::string _display_prefix;
+
+	static std::string strip(const std::string& value, const std::string& prefix);
+
+public:
+	host_filter() : _host_prefix(), _alias_prefix(), _display_prefix() { }
+	host_filter(const std::string& host_prefix, const std::string& alias_prefix, const std::string& display_prefix) : _host_prefix(host_prefix), _alias_prefix(alias_prefix), _display_prefix(display_prefix) { }
+
+	// users.<user>.host-prefix, users.<user>.alias-prefix, users.<user>.display-prefix
+	static host_filter for_user(string_map& configuration, const std::string& user);
+
+	inline const std::string& host_prefix() const { return _host_prefix; }
+	inline const std::string& alias_prefix() const { return _alias_prefix; }
+	inline const std::string& display_prefix() const { return _display_prefix; }
+
+	inline bool empty() const { return !_host_prefix.size() && !_alias_prefix.size() && !_display_prefix.size(); }
+
+	// The filter to apply to the hosts of an instance before they are given
+	// host_prefix; false if none of them can be shown.
+	bool within(const std::string& host_prefix, host_filter& filter) const;
+
+	// Identifies the filter in cache keys.
+	std::string key() const;
+
+	// Whether the user may see host at all; matches() also requires it to
+	// have services to show.
+	bool visible(const nagios_host& host) const;
+	bool matches(const nagios_host& host) const;
+	std::string host_name(const nagios_host& host) const;
+	std::string alias(const nagios_host& host) const;
+	std::string display_name(const nagios_host& host) const;
+	json apply(const nagios_host& host) const;
+};
+
+#endif
@@ -0,0 +1,580 @@
+#include "globals.h"
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "http_server.h"
+#include "string_map.h"
+#include "strutil.h"
+
+using namespace std;
+
+const string::size_type http_server::max_header_size;
+const unsigned http_server::max_pipeline;
+
+namespace
+{
+	uint64_t thread_cpu_time()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+	}
+
+	void fail(http_response& response)
+	{
+		response.status = "500 Internal Server Error";
+		response.content_type = "text/plain";
+		response.body.reset();
+	}
+	// A handler that throws fails its own request, not the server.
+	void call(const http_server::handler& h, const http_request& request, http_response& response)
+	{
+		try
+		{
+			h(request, response);
+		}
+		catch (...)
+		{
+			fail(response);
+		}
+	}
+	// So does a shortcut, which then answers the request, leaving the loop
+	// running.
+	bool call(const http_server::shortcut& s, const http_request& request, http_response& response)
+	{
+		try
+		{
+			return s && s(request, response);
+		}
+		catch (...)
+		{
+			fail(response);
+			return true;
+		}
+	}
+}
+
+struct http_server::reply
+{
+	http_request request;
+	http_response response;
+	bool keep_alive;
+	bool done;
+	chrono::steady_clock::time_point parsed;
+	uint64_t cpu; // nanoseconds spent by the handler
+};
+
+struct http_server::connection
+{
+	struct chunk
+	{
+		shared_ptr<const string> data;
+		string::size_type offset;
+	};
+
+	int fd;
+	uint64_t id; // tells apart connections that got the same descriptor
+	string input;
+	deque<shared_ptr<reply> > replies; // parsed, not yet queued for output
+	deque<chunk> output;
+	bool last; // no further request is to be parsed
+	bool closing; // once the queued output is sent
+	bool eof;
+	uint32_t events; // as last given to epoll
+
+	connection(int f, uint64_t i) : fd(f), id(i), input(), replies(), output(), last(false), closing(false), eof(false), events(EPOLLIN | EPOLLRDHUP) { }
+	~connection() { close(fd); }
+};
+
+http_server::http_server(unsigned workers) : _epoll_fd(epoll_create1(EPOLL_CLOEXEC)), _listen_fd(-1), _unix(false), _event_fd(-1), _next_id(0), _connections(), _watches(), _handler(), _shortcut(), _worker_count(workers), _workers(), _mutex(), _queued(), _jobs(), _finished(), _stopping(false), _started(chrono::steady_clock::now()), _statistics() { }
+
+http_server::~http_server()
+{
+	{
+		lock_guard<mutex> lock(_mutex);
+		_stopping = true;
+	}
+	_queued.notify_all();
+	for (vector<thread>::iterator it = _workers.begin(); it != _workers.end(); ++it)
+		it->join();
+	_connections.clear();
+	if (_event_fd >= 0)
+		close(_event_fd);
+	if (_listen_fd >= 0)
+		close(_listen_fd);
+	if (_epoll_fd >= 0)
+		close(_epoll_fd);
+}
+
+// A socket left by a previous run is replaced, but no other kind of file.
+bool http_server::listen_unix(const string& path)
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(addr.sun_path))
+		return false;
+	memcpy(addr.sun_path, path.data(), path.size());
+	struct stat st;
+	if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+	if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, SOMAXCONN) != 0)
+	{
+		close(fd);
+		return false;
+	}
+	_listen_fd = fd;
+	_unix = true;
+	return true;
+}
+
+bool http_server::listen(const string& address)
+{
+	if (starts_with(address, "unix:"))
+	{
+		if (!listen_unix(address.substr(5)))
+			return false;
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.fd = _listen_fd;
+		return epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &event) == 0;
+	}
+	string::size_type colon = address.rfind(':');
+	if (colon == string::npos)
+		return false;
+	string host(address.substr(0, colon)), port(address.substr(colon + 1));
+	if (host.size() > 1 && host[0] == '[' && host[host.size() - 1] == ']')
+		host = host.substr(1, host.size() - 2);
+	struct addrinfo hints, *result;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if (getaddrinfo(host.size() ? host.c_str() : nullptr, port.c_str(), &hints, &result) != 0)
+		return false;
+	for (struct addrinfo* ai = result; ai && _listen_fd < 0; ai = ai->ai_next)
+	{
+		int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0)
+			_listen_fd = fd;
+		else
+			close(fd);
+	}
+	freeaddrinfo(result);
+	if (_listen_fd < 0)
+		return false;
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = _listen_fd;
+	return epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &event) == 0;
+}
+
+void http_server::watch(int fd, const callback& c)
+{
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.fd = fd;
+	if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) == 0)
+		_watches[fd] = c;
+}
+
+void http_server::accept_all()
+{
+	int fd;
+	while ((fd = accept4(_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		int one = 1;
+		if (!_unix)
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		struct epoll_event event;
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = fd;
+		if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		_connections[fd].reset(new connection(fd, _next_id++));
+	}
+}
+
+void http_server::respond(connection& c, const reply& r)
+{
+	_statistics.latency.record(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - r.parsed).count());
+	_statistics.cpu.record(r.cpu);
+	string::size_type length = r.response.body ? r.response.body->size() : 0;
+	shared_ptr<string> head(new string());
+	*head += r.request.version == "HTTP/1.0" ? "HTTP/1.0 " : "HTTP/1.1 ";
+	*head += r.response.status;
+	*head += "\r\nContent-Type: ";
+	*head += r.response.content_type;
+	*head += "\r\nContent-Length: " + to_string(length) + "\r\n";
+	*head += "Vary: Accept\r\nCache-Control: no-cache, no-store, must-revalidate\r\n";
+	*head += r.keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	connection::chunk chunk = { head, 0 };
+	c.output.push_back(chunk);
+	if (length && r.request.method != "HEAD")
+	{
+		connection::chunk body = { r.response.body, 0 };
+		c.output.push_back(body);
+	}
+	if (!r.keep_alive)
+		c.closing = true;
+}
+
+void http_server::process(connection& c)
+{
+	string::size_type start = 0;
+	while (!c.last && c.replies.size() + c.output.size() / 2 < max_pipeline)
+	{
+		shared_ptr<reply> r(new reply());
+		r->response.status = "400 Bad Request";
+		r->response.content_type = "text/plain";
+		r->keep_alive = false;
+		r->done = true;
+		r->parsed = chrono::steady_clock::now();
+		r->cpu = 0;
+		http_request& request = r->request;
+		string::size_type end = c.input.find("\r\n\r\n", start);
+		if (end == string::npos)
+		{
+			if (c.input.size() - start > max_header_size)
+			{
+				request.version = "HTTP/1.1";
+				r->response.status = "431 Request Header Fields Too Large";
+				c.replies.push_back(r);
+				c.last = true;
+			}
+			break;
+		}
+		string::size_type line_end = c.input.find("\r\n", start);
+		string line(c.input, start, line_end - start);
+		string::size_type sp1 = line.find(' '), sp2 = line.rfind(' ');
+		bool valid = sp1 != string::npos && sp2 > sp1;
+		if (valid)
+		{
+			request.method = line.substr(0, sp1);
+			request.target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+			request.version = line.substr(sp2 + 1);
+			valid = starts_with(request.version, "HTTP/1.");
+		}
+		for (string::size_type pos = line_end + 2; valid && pos < end; )
+		{
+			string::size_type eol = c.input.find("\r\n", pos);
+			string::size_type colon = c.input.find(':', pos);
+			if (colon == string::npos || colon > eol)
+				valid = false;
+			else
+			{
+				string name(c.input, pos, colon - pos), value(c.input, colon + 1, eol - colon - 1);
+				for (string::iterator it = name.begin(); it != name.end(); ++it)
+					*it = tolower(*it);
+				trim(value);
+				string& stored = request.headers[name];
+				stored += stored.size() ? ", " + value : value;
+			}
+			pos = eol + 2;
+		}
+		// A body, which no resource here takes, is read and ignored. The
+		// whole request has to fit in what receive() buffers, or reading
+		// would stop before it is complete.
+		string::size_type next = end + 4;
+		string_map::const_iterator length = request.headers.find("content-length");
+		if (valid && length != request.headers.end())
+		{
+			unsigned long long size = strtoull(length->second.c_str(), nullptr, 10);
+			if (size > max_header_size || next - start + size > max_header_size)
+			{
+				r->response.status = "413 Payload Too Large";
+				valid = false;
+			}
+			else if (size > c.input.size() - next)
+				break;
+			else
+				next += size;
+		}
+		if (request.headers.count("transfer-encoding"))
+			valid = false;
+		start = next;
+		string connection_header(request.headers["connection"]);
+		for (string::iterator it = connection_header.begin(); it != connection_header.end(); ++it)
+			*it = tolower(*it);
+		r->keep_alive = valid && (request.version == "HTTP/1.0" ? connection_header == "keep-alive" : connection_header != "close");
+		c.last = !r->keep_alive;
+		c.replies.push_back(r);
+		if (!valid)
+			request.version = "HTTP/1.1";
+		else if (request.method != "GET" && request.method != "HEAD")
+			r->response.status = "405 Method Not Allowed";
+		else
+		{
+			uint64_t cpu = thread_cpu_time();
+			bool answered = call(_shortcut, request, r->response);
+			if (!answered && !_worker_count)
+			{
+				call(_handler, request, r->response);
+				answered = true;
+			}
+			r->cpu = thread_cpu_time() - cpu;
+			if (!answered)
+			{
+				r->done = false;
+				job j = { c.fd, c.id, r };
+				lock_guard<mutex> lock(_mutex);
+				_jobs.push_back(j);
+				_queued.notify_one();
+			}
+		}
+	}
+	c.input.erase(0, start);
+}
+
+void http_server::deliver(connection& c)
+{
+	while (c.replies.size() && c.replies.front()->done)
+	{
+		respond(c, *c.replies.front());
+		c.replies.pop_front();
+	}
+}
+
+void http_server::receive(connection& c)
+{
+	char buf[16384];
+	for (; ; )
+	{
+		ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+		if (n > 0)
+		{
+			c.input.append(buf, n);
+			if (static_cast<size_t>(n) < sizeof(buf) || c.input.size() > max_header_size)
+				break;
+			continue;
+		}
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		// Peer gone or shut down its side: answer what was received.
+		process(c);
+		c.last = true;
+		c.eof = true;
+		return;
+	}
+	process(c);
+}
+
+bool http_server::flush(connection& c)
+{
+	while (c.output.size())
+	{
+		struct iovec iov[64];
+		int count = 0;
+		for (deque<connection::chunk>::const_iterator it = c.output.begin(); it != c.output.end() && count < 64; ++it, ++count)
+		{
+			iov[count].iov_base = const_cast<char*>(it->data->data() + it->offset);
+			iov[count].iov_len = it->data->size() - it->offset;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t n = sendmsg(c.fd, &msg, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return true;
+		if (n < 0)
+			return false;
+		while (n > 0)
+		{
+			connection::chunk& front = c.output.front();
+			string::size_type left = front.data->size() - front.offset;
+			if (static_cast<size_t>(n) < left)
+			{
+				front.offset += n;
+				n = 0;
+			}
+			else
+			{
+				n -= left;
+				c.output.pop_front();
+			}
+		}
+	}
+	return !c.closing && !(c.last && c.replies.empty());
+}
+
+bool http_server::advance(connection& c)
+{
+	deliver(c);
+	bool open = flush(c);
+	// Requests held back while the pipeline was full.
+	while (open && c.output.empty() && c.input.size())
+	{
+		string::size_type before = c.input.size();
+		process(c);
+		deliver(c);
+		open = flush(c);
+		if (c.input.size() == before)
+			break;
+	}
+	if (open)
+		update(c);
+	return open;
+}
+
+// Reading stops at end of file, and while enough input is waiting for
+// the pipeline to drain.
+void http_server::update(connection& c)
+{
+	uint32_t events = 0;
+	if (!c.eof && c.input.size() <= max_header_size)
+		events |= EPOLLIN | EPOLLRDHUP;
+	if (c.output.size())
+		events |= EPOLLOUT;
+	if (events == c.events)
+		return;
+	struct epoll_event event;
+	event.events = events;
+	event.data.fd = c.fd;
+	epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, c.fd, &event);
+	c.events = events;
+}
+
+void http_server::work()
+{
+	for (; ; )
+	{
+		job j;
+		{
+			unique_lock<mutex> lock(_mutex);
+			while (!_stopping && _jobs.empty())
+				_queued.wait(lock);
+			if (_stopping)
+				return;
+			j = _jobs.front();
+			_jobs.pop_front();
+		}
+		uint64_t cpu = thread_cpu_time();
+		call(_handler, j.r->request, j.r->response);
+		j.r->cpu += thread_cpu_time() - cpu;
+		{
+			lock_guard<mutex> lock(_mutex);
+			_finished.push_back(j);
+		}
+		uint64_t one = 1;
+		if (write(_event_fd, &one, sizeof(one)) < 0)
+			continue;
+	}
+}
+
+void http_server::collect()
+{
+	uint64_t count;
+	if (read(_event_fd, &count, sizeof(count)) < 0)
+		return;
+	deque<job> finished;
+	{
+		lock_guard<mutex> lock(_mutex);
+		finished.swap(_finished);
+	}
+	for (deque<job>::iterator it = finished.begin(); it != finished.end(); ++it)
+	{
+		// The reply is kept by the connection, if it is still open.
+		it->r->done = true;
+		map<int, unique_ptr<connection> >::iterator c = _connections.find(it->fd);
+		if (c != _connections.end() && c->second->id == it->connection_id && !advance(*c->second))
+			_connections.erase(c);
+	}
+}
+
+http_statistics http_server::statistics() const
+{
+	http_statistics s(_statistics);
+	s.seconds = chrono::duration<double>(chrono::steady_clock::now() - _started).count();
+	return s;
+}
+
+int http_server::run(const handler& h, const shortcut& s)
+{
+	_handler = h;
+	_shortcut = s;
+	if (_worker_count)
+	{
+		_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		struct epoll_event event;
+		event.events = EPOLLIN;
+		event.data.fd = _event_fd;
+		if (_event_fd < 0 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _event_fd, &event) != 0)
+			return 1;
+		for (unsigned i(0); i < _worker_count; ++i)
+			_workers.emplace_back(&http_server::work, this);
+	}
+	struct epoll_event events[256];
+	for (; ; )
+	{
+		int n = epoll_wait(_epoll_fd, events, 256, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return 1;
+		for (int i(0); i < n; ++i)
+		{
+			int fd = events[i].data.fd;
+			if (fd == _listen_fd)
+			{
+				accept_all();
+				continue;
+			}
+			if (fd == _event_fd)
+			{
+				collect();
+				continue;
+			}
+			map<int, callback>::iterator w = _watches.find(fd);
+			if (w != _watches.end())
+			{
+				w->second();
+				continue;
+			}
+			map<int, unique_ptr<connection> >::iterator it = _connections.find(fd);
+			if (it == _connections.end())
+				continue;
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+				receive(*it->second);
+			if (!advance(*it->second))
+				_connections.erase(it);
+		}
+	}
+}
@@ -0,0 +1,122 @@
+#ifndef __HTTP_SERVER_H
+#define __HTTP_SERVER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "string_map.h"
+
+// Header names are lowercased.
+struct http_request
+{
+	std::string method;
+	std::string target;
+	std::string version;
+	string_map headers;
+};
+
+// The body is shared so that a cached response is queued on any number of
+// connections without being copied.
+struct http_response
+{
+	const char* status;
+	const char* content_type;
+	std::shared_ptr<const std::string> body;
+};
+
+// Requests answered since the server started: how long each took from being
+// parsed to its response being queued for output, and the CPU time the
+// handler spent on it.
+struct http_statistics
+{
+	double seconds;
+	latency_histogram latency;
+	latency_histogram cpu;
+};
+
+// A minimal HTTP/1.1 server: one thread and one epoll loop handle the
+// connections, which are persistent, and pipelined requests are answered in
+// order. With workers, the handler runs on a pool of threads so that a slow
+// response does not hold up the others; without, on the loop itself. Other
+// descriptors (inotify, timers) can be watched by the same loop.
+class http_server
+{
+public:
+	typedef std::function<void(const http_request&, http_response&)> handler;
+	// Answers on the loop, without a worker, when it returns true.
+	typedef std::function<bool(const http_request&, http_response&)> shortcut;
+	typedef std::function<void()> callback;
+
+	static const std::string::size_type max_header_size = 65536;
+	// Requests in progress on a connection before further ones are parsed.
+	static const unsigned max_pipeline = 32;
+
+private:
+	struct connection;
+	struct reply;
+	struct job
+	{
+		int fd;
+		std::uint64_t connection_id;
+		std::shared_ptr<reply> r;
+	};
+
+	int _epoll_fd;
+	int _listen_fd;
+	bool _unix; // listening on a UNIX domain socket
+	int _event_fd; // signals finished jobs to the loop
+	std::uint64_t _next_id;
+	std::map<int, std::unique_ptr<connection> > _connections;
+	std::map<int, callback> _watches;
+	handler _handler;
+	shortcut _shortcut;
+	unsigned _worker_count;
+	std::vector<std::thread> _workers;
+	std::mutex _mutex;
+	std::condition_variable _queued;
+	std::deque<job> _jobs;
+	std::deque<job> _finished;
+	bool _stopping;
+	std::chrono::steady_clock::time_point _started;
+	http_statistics _statistics;
+
+	bool listen_unix(const std::string& path);
+	void accept_all();
+	void receive(connection& c);
+	void process(connection& c);
+	// Queues the responses that are ready, in request order.
+	void deliver(connection& c);
+	// Returns false once the connection is to be closed.
+	bool flush(connection& c);
+	bool advance(connection& c);
+	void update(connection& c);
+	void respond(connection& c, const reply& r);
+	void work();
+	void collect();
+
+public:
+	explicit http_server(unsigned workers = 0);
+	~http_server();
+
+	// host:port, [host]:port, :port for the wildcard address, or unix:path.
+	bool listen(const std::string& address);
+	void watch(int fd, const callback& c);
+	// Serves until epoll fails.
+	int run(const handler& h, const shortcut& s = shortcut());
+
+	// Kept by the loop, hence only to be read from a shortcut, or from the
+	// handler when there are no workers.
+	http_statistics statistics() const;
+};
+
+#endif
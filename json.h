@@ -189,102 +189,9 @@ public :
 			throw std::logic_error("Trying to access non-map json as map");
 		return *_map_value;
 	}
-
-private :
-	static void put_string(std::ostream& os, const string_type& s)
-	{
-		os << '"';
-		string_type::const_iterator end = s.end();
-		for (string_type::const_iterator it = s.begin(); it != end; ++it)
-		{
-			char c = *it;
-			switch (c)
-			{
-				case '\\' :
-				case '"' :
-				case '/' :
-					os << '\\' << c;
-				case '\b' :
-					os << '\\' << 'b';
-					break;
-				case '\f' :
-					os << '\\' << 'f';
-					break;
-				case '\n' :
-					os << '\\' << 'n';
-					break;
-				case '\r' :
-					os << '\\' << 'r';
-					break;
-				case '\t' :
-					os << '\\' << 't';
-					break;
-				default :
-					os << c;
-					break;
-			}
-		}
-		os << '"';
-	}
-
-public :
-	friend std::ostream& operator <<(std::ostream& os, const json& value)
-	{
-		switch (value._type)
-		{
-			case JSON_TYPE_NUMBER :
-				{
-					long long llvalue(value._num_value);
-					if (llvalue == value._num_value)
-						os << llvalue;
-					else
-						os << std::to_string(value._num_value);
-				}
-				break;
-			case JSON_TYPE_STRING :
-				put_string(os, *value._str_value);
-				break;
-			case JSON_TYPE_VECTOR :
-				{
-					os << '[';
-					bool first = true;
-					vector_type& vec = *value._vec_value;
-					vector_type::iterator vend = vec.end();
-					for (vector_type::iterator it = vec.begin(); it != vend; ++it)
-					{
-						if (first)
-							first = false;
-						else
-							os << ',';
-						os << *it;
-					}
-					os << ']';
-				}
-				break;
-			case JSON_TYPE_MAP :
-				{
-					os << '{';
-					bool first = true;
-					map_type& map = *value._map_value;
-					map_type::iterator mend = map.end();
-					for (map_type::iterator it = map.begin(); it != mend; ++it)
-					{
-						if (first)
-							first = false;
-						else
-							os << ',';
-						put_string(os, it->first);
-						os << ':' << it->second;
-					}
-					os << '}';
-				}
-				break;
-			default :
-				os << "null";
-				break;
-		}
-		return os;
-	}
 };
 
+// Defined along with json_serializer in serializer.cxx
+std::ostream& operator <<(std::ostream& os, const json& value);
+
 #endif
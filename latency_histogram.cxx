@@ -0,0 +1,58 @@
+#include "globals.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "latency_histogram.h"
+
+using namespace std;
+
+const unsigned latency_histogram::sub_buckets;
+const unsigned latency_histogram::bucket_count;
+
+latency_histogram::latency_histogram() : _count(0), _total(0), _maximum(0)
+{
+	memset(_buckets, 0, sizeof(_buckets));
+}
+
+// Values below 16 have a bucket each; above, the 4 bits that follow the
+// most significant one pick one of the 16 buckets of its power of two.
+unsigned latency_histogram::bucket(uint64_t value)
+{
+	if (value < sub_buckets)
+		return value;
+	unsigned msb = 63 - __builtin_clzll(value);
+	return (msb - 3) * sub_buckets + ((value >> (msb - 4)) & (sub_buckets - 1));
+}
+uint64_t latency_histogram::upper_bound(unsigned bucket)
+{
+	if (bucket < sub_buckets)
+		return bucket;
+	unsigned msb = bucket / sub_buckets + 3;
+	uint64_t low = static_cast<uint64_t>(sub_buckets + bucket % sub_buckets) << (msb - 4);
+	return low + ((static_cast<uint64_t>(1) << (msb - 4)) - 1);
+}
+
+void latency_histogram::record(uint64_t value)
+{
+	++_buckets[bucket(value)];
+	++_count;
+	_total += value;
+	if (value > _maximum)
+		_maximum = value;
+}
+
+uint64_t latency_histogram::percentile(double q) const
+{
+	if (!_count)
+		return 0;
+	uint64_t rank = static_cast<uint64_t>(ceil(q * _count));
+	if (rank < 1)
+		rank = 1;
+	uint64_t seen = 0;
+	for (unsigned i(0); i < bucket_count; ++i)
+		if ((seen += _buckets[i]) >= rank)
+			return upper_bound(i) < _maximum ? upper_bound(i) : _maximum;
+	return _maximum;
+}
@@ -0,0 +1,40 @@
+#ifndef __LATENCY_HISTOGRAM_H
+#define __LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+
+// Counts of durations in nanoseconds, in buckets of logarithmic width: 16
+// per power of two, so that a percentile is known within 1/16 of its value
+// whatever its magnitude, in fixed memory and without allocation.
+class latency_histogram
+{
+public:
+	static const unsigned sub_buckets = 16;
+	static const unsigned bucket_count = (64 - 4 + 1) * sub_buckets;
+
+private:
+	std::uint64_t _buckets[bucket_count];
+	std::uint64_t _count;
+	std::uint64_t _total;
+	std::uint64_t _maximum;
+
+	static unsigned bucket(std::uint64_t value);
+	// The largest value counted in a bucket.
+	static std::uint64_t upper_bound(unsigned bucket);
+
+public:
+	latency_histogram();
+
+	void record(std::uint64_t value);
+
+	inline std::uint64_t count() const { return _count; }
+	inline std::uint64_t total() const { return _total; }
+	inline std::uint64_t maximum() const { return _maximum; }
+	inline double mean() const { return _count ? static_cast<double>(_total) / _count : 0; }
+
+	// The value below which a fraction q of the durations lie, rounded up
+	// to the end of its bucket; 0 when empty.
+	std::uint64_t percentile(double q) const;
+};
+
+#endif
@@ -99,11 +99,14 @@ public:
 	}
 };
 
-class parse_error : public std::runtime_error
+// What the parsers return rather than throw: a plugin writing malformed
+// perfdata is common, and must not cost more than the service it is on.
+enum parse_status
 {
-public:
-	parse_error() : std::runtime_error("Parse error") { }
-	explicit parse_error(const std::string& message) : std::runtime_error(message) { }
+	parse_ok,
+	parse_bad_syntax,
+	parse_bad_number,
+	parse_bad_range
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,121 @@
+#!/bin/sh
+# Load test for "make loadtest": concurrent clients run the binary the ways
+# it is deployed, over the synthetic data of pgo-train.sh, while status.dat
+# is rewritten every $INTERVAL seconds as Nagios does. First as CGI, each
+# client spawning the binary with the CGI environment, then as clients of
+# the server (-s) over a UNIX socket, on keep-alive connections. Reports
+# requests per second, p50/p99/p999 latency and the CPU time per request.
+# The server run needs curl.
+#
+# Usage: loadtest.sh binary directory [clients] [seconds] [query]
+# Environment: INTERVAL (10), HOSTS (3000), BATCH (requests per connection, 50)
+
+binary=$1
+dir=$2
+clients=${3:-16}
+seconds=${4:-30}
+query=${5:-summary}
+interval=${INTERVAL:-10}
+hosts=${HOSTS:-3000}
+batch=${BATCH:-50}
+if [ -z "$binary" ] || [ -z "$dir" ]; then
+	echo "Usage: $0 binary directory [clients] [seconds] [query]" >&2
+	exit 1
+fi
+"$(dirname "$0")/pgo-train.sh" "$binary" "$dir" "$hosts" || exit 1
+cp "$dir/status.dat" "$dir/status.orig"
+{ cat "$dir/nagios-json.conf"; echo "listen=unix:$dir/server.sock"; } > "$dir/server.conf"
+
+pids=
+trap 'kill $pids 2>/dev/null' EXIT
+trap 'exit 1' INT TERM
+
+# Written aside and renamed into place, with new check times each pass.
+rewrite()
+{
+	n=0
+	while :; do
+		sleep "$interval"
+		n=$((n + 1))
+		sed "s/^	last_check=.*/	last_check=$((1700000000 + n * interval))/" "$dir/status.orig" > "$dir/status.tmp" && mv "$dir/status.tmp" "$dir/status.dat"
+	done
+}
+
+# Latencies, one per line in seconds, of all clients.
+report()
+{
+	name=$1
+	elapsed=$2
+	cpu=$3
+	cat "$dir"/latency.* | sort -n | awk -v name="$name" -v elapsed="$elapsed" -v cpu="$cpu" '
+	function at(p) { i = int(p * NR) + 1; return (i > NR ? l[NR] : l[i]) * 1000 }
+	{ l[NR] = $1 }
+	END {
+		if (!NR) { print name ": no request completed"; exit 1 }
+		printf "%s: %d requests in %.1f s, %.1f/s; latency p50 %.3f, p99 %.3f, p999 %.3f ms; CPU %.3f ms per request\n", name, NR, elapsed, NR / elapsed, at(0.5), at(0.99), at(0.999), cpu
+	}'
+}
+
+
+cgi_client()
+{
+	end=$(($(date +%s) + seconds))
+	while [ "$(date +%s)" -lt "$end" ]; do
+		start=$(date +%s%N)
+		env QUERY_STRING="$query" "$binary" "$dir/nagios-json.conf" > /dev/null
+		echo "$(($(date +%s%N) - start))" | awk '{ print $1 / 1e9 }'
+	done > "$dir/latency.$1"
+	# The CPU time of the shell's children, second line of times, which has
+	# to run in this shell rather than in a pipeline.
+	times > "$dir/cpu.$1"
+}
+
+server_client()
+{
+	urls=$(awk -v n="$batch" -v q="$query" 'BEGIN { for (i = 0; i < n; ++i) printf "http://localhost/?%s ", q }')
+	end=$(($(date +%s) + seconds))
+	while [ "$(date +%s)" -lt "$end" ]; do
+		curl -s --unix-socket "$dir/server.sock" -w '%{stderr}%{time_total}\n' $urls > /dev/null
+	done 2> "$dir/latency.$1"
+}
+
+run()
+{
+	rm -f "$dir"/latency.* "$dir"/cpu.*
+	start=$(date +%s%N)
+	i=0
+	client_pids=
+	while [ $i -lt "$clients" ]; do
+		$1 $i &
+		client_pids="$client_pids $!"
+		i=$((i + 1))
+	done
+	wait $client_pids
+	echo "$(($(date +%s%N) - start))" | awk '{ print $1 / 1e9 }'
+}
+
+rewrite &
+pids=$!
+
+elapsed=$(run cgi_client)
+cpu=$(awk 'FNR == 2 { split($1, u, /[ms]/); split($2, k, /[ms]/); s += u[1] * 60 + u[2] + k[1] * 60 + k[2] } END { print s }' "$dir"/cpu.*)
+requests=$(cat "$dir"/latency.* | wc -l)
+report "CGI, $clients clients, ?$query" "$elapsed" "$(awk -v s="$cpu" -v n="$requests" 'BEGIN { print n ? s * 1000 / n : 0 }')" || exit 1
+
+if ! command -v curl > /dev/null; then
+	echo "curl not found, server not tested" >&2
+	exit 0
+fi
+rm -f "$dir/server.sock"
+"$binary" -s "$dir/server.conf" > /dev/null &
+pids="$pids $!"
+i=0
+while [ ! -S "$dir/server.sock" ] && [ $i -lt 600 ]; do
+	sleep 0.1
+	i=$((i + 1))
+done
+elapsed=$(run server_client)
+# The server measures its own CPU time per request, given by ?stats.
+cpu=$(curl -s --unix-socket "$dir/server.sock" 'http://localhost/?stats' | sed -n 's/.*"cpu":{[^}]*"mean":\([0-9.e+-]*\).*/\1/p')
+report "server, $clients clients, ?$query" "$elapsed" "${cpu:-0}" || exit 1
+rm -f "$dir"/latency.* "$dir"/cpu.* "$dir/status.tmp"
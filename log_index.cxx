@@ -0,0 +1,335 @@
+#include "globals.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "log_index.h"
+#include "strutil.h"
+
+using namespace std;
+
+namespace
+{
+	const char index_magic[8] = { 'N', 'J', 'L', 'O', 'G', 'I', '1', '\0' };
+
+	// [time] HOST ALERT: host;state;type;attempt;output
+	// [time] SERVICE ALERT: host;service;state;type;attempt;output
+	struct alert
+	{
+		uint32_t time;
+		const char* host;
+		size_t host_length;
+		const char* service; // nullptr for a host alert
+		size_t service_length;
+		const char* rest;
+	};
+
+	bool parse_alert(const char* p, const char* end, alert& a)
+	{
+		static const char host_alert[] = "HOST ALERT: ", service_alert[] = "SERVICE ALERT: ";
+		if (p == end || *p != '[')
+			return false;
+		a.time = 0;
+		for (++p; p < end && *p >= '0' && *p <= '9'; ++p)
+			a.time = a.time * 10 + (*p - '0');
+		if (end - p < 2 || p[0] != ']' || p[1] != ' ')
+			return false;
+		p += 2;
+		bool service;
+		if (static_cast<size_t>(end - p) >= sizeof(service_alert) - 1 && memcmp(p, service_alert, sizeof(service_alert) - 1) == 0)
+		{
+			service = true;
+			p += sizeof(service_alert) - 1;
+		}
+		else if (static_cast<size_t>(end - p) >= sizeof(host_alert) - 1 && memcmp(p, host_alert, sizeof(host_alert) - 1) == 0)
+		{
+			service = false;
+			p += sizeof(host_alert) - 1;
+		}
+		else
+			return false;
+		const char* semicolon = static_cast<const char*>(memchr(p, ';', end - p));
+		if (!semicolon)
+			return false;
+		a.host = p;
+		a.host_length = semicolon - p;
+		p = semicolon + 1;
+		a.service = nullptr;
+		a.service_length = 0;
+		if (service)
+		{
+			if (!(semicolon = static_cast<const char*>(memchr(p, ';', end - p))))
+				return false;
+			a.service = p;
+			a.service_length = semicolon - p;
+			p = semicolon + 1;
+		}
+		a.rest = p;
+		return true;
+	}
+
+	uint32_t hash_name(const string& name)
+	{
+		return static_cast<uint32_t>(hash_string(name));
+	}
+	// 0 stands for host alerts.
+	uint32_t hash_service(const string& service_description)
+	{
+		uint32_t hash = hash_name(service_description);
+		return hash ? hash : 1;
+	}
+}
+
+struct log_index::header
+{
+	char magic[8];
+	uint64_t device;
+	uint64_t inode;
+	uint64_t indexed; // bytes of the log, up to a line end
+	uint64_t count;
+};
+
+struct log_index::entry
+{
+	uint64_t offset;
+	uint32_t time;
+	uint32_t length;
+	uint32_t host;
+	uint32_t service;
+};
+
+namespace
+{
+	// Indexes the complete lines of the log between from and to, returns
+	// where the last of them ends.
+	template<typename Entry>
+	uint64_t scan(int fd, uint64_t from, uint64_t to, vector<Entry>& entries)
+	{
+		if (from >= to)
+			return from;
+		void* map = mmap(nullptr, to, PROT_READ, MAP_SHARED, fd, 0);
+		if (map == MAP_FAILED)
+			return from;
+		madvise(map, to, MADV_SEQUENTIAL);
+		const char* base = static_cast<const char*>(map);
+		const char* p = base + from;
+		const char* end = base + to;
+		const char* newline;
+		alert a;
+		while ((newline = static_cast<const char*>(memchr(p, '\n', end - p))))
+		{
+			if (parse_alert(p, newline, a))
+			{
+				Entry e;
+				e.offset = p - base;
+				e.time = a.time;
+				e.length = newline - p;
+				e.host = hash_name(string(a.host, a.host_length));
+				e.service = a.service ? hash_service(string(a.service, a.service_length)) : 0;
+				entries.push_back(e);
+			}
+			p = newline + 1;
+		}
+		munmap(map, to);
+		return p - base;
+	}
+
+	bool write_all(int fd, const void* data, size_t size, off_t offset)
+	{
+		const char* p = static_cast<const char*>(data);
+		while (size)
+		{
+			ssize_t w = pwrite(fd, p, size, offset);
+			if (w <= 0)
+				return false;
+			p += w;
+			size -= w;
+			offset += w;
+		}
+		return true;
+	}
+}
+
+log_index::~log_index()
+{
+	if (_map)
+		munmap(_map, _size);
+}
+
+bool log_index::attach(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(header))
+		return false;
+	void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		return false;
+	const header* h = static_cast<const header*>(map);
+	uint64_t count = __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+	if (memcmp(h->magic, index_magic, sizeof(index_magic)) != 0 || sizeof(header) + count * sizeof(entry) > static_cast<size_t>(st.st_size))
+	{
+		munmap(map, st.st_size);
+		return false;
+	}
+	_map = map;
+	_size = st.st_size;
+	_header = h;
+	_entries = reinterpret_cast<const entry*>(h + 1);
+	_count = count;
+	return true;
+}
+
+// Appending is serialized by a lock on the index; a rebuilt index replaces
+// the previous one by a rename, so that readers never see it shrink.
+bool log_index::open(const string& log_path, const string& index_path)
+{
+	_log_path = log_path;
+	int log_fd = ::open(log_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (log_fd < 0)
+		return false;
+	struct stat log;
+	if (fstat(log_fd, &log) != 0)
+	{
+		close(log_fd);
+		return false;
+	}
+	uint64_t log_size = log.st_size;
+	int fd = ::open(index_path.c_str(), O_RDWR | O_CLOEXEC);
+	bool writable = fd >= 0, missing = fd < 0 && errno == ENOENT;
+	if (!writable && !missing)
+		fd = ::open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+	header h;
+	bool current = fd >= 0 && (!writable || flock(fd, LOCK_EX) == 0) && pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+		memcmp(h.magic, index_magic, sizeof(index_magic)) == 0 && h.device == static_cast<uint64_t>(log.st_dev) &&
+		h.inode == static_cast<uint64_t>(log.st_ino) && h.indexed <= log_size;
+	if (current && writable && h.indexed < log_size)
+	{
+		vector<entry> entries;
+		uint64_t indexed = scan(log_fd, h.indexed, log_size, entries);
+		if (write_all(fd, entries.data(), entries.size() * sizeof(entry), sizeof(header) + h.count * sizeof(entry)))
+		{
+			h.count += entries.size();
+			h.indexed = indexed;
+			write_all(fd, &h, sizeof(h), 0);
+		}
+	}
+	else if (!current && (writable || missing))
+	{
+		if (fd >= 0)
+			close(fd);
+		fd = -1;
+		memcpy(h.magic, index_magic, sizeof(index_magic));
+		h.device = log.st_dev;
+		h.inode = log.st_ino;
+		vector<entry> entries;
+		h.indexed = scan(log_fd, 0, log_size, entries);
+		h.count = entries.size();
+		string temp_path(index_path + ".tmp." + to_string(getpid()));
+		int temp_fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (temp_fd >= 0)
+		{
+			bool written = write_all(temp_fd, &h, sizeof(h), 0) && write_all(temp_fd, entries.data(), entries.size() * sizeof(entry), sizeof(h));
+			if (close(temp_fd) == 0 && written && rename(temp_path.c_str(), index_path.c_str()) == 0)
+				fd = ::open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+			else
+				unlink(temp_path.c_str());
+		}
+	}
+	close(log_fd);
+	if (fd < 0)
+		return false;
+	bool attached = attach(fd);
+	close(fd);
+	return attached;
+}
+
+time_t log_index::first() const
+{
+	return _count ? _entries[0].time : 0;
+}
+time_t log_index::last() const
+{
+	return _count ? _entries[_count - 1].time : 0;
+}
+
+void log_index::query(const string& host_name, const string& service_description, time_t start, time_t end, vector<json>& events) const
+{
+	if (!_count || end <= start)
+		return;
+	const entry* begin = lower_bound(_entries, _entries + _count, start, [](const entry& e, time_t t) { return e.time < t; });
+	const entry* stop = _entries + _count;
+	uint32_t host = hash_name(host_name), service = service_description.size() ? hash_service(service_description) : 0;
+	// The log is mapped only now, and only if it is still the one indexed.
+	int fd = ::open(_log_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	struct stat st;
+	void* log_map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_dev) == _header->device && static_cast<uint64_t>(st.st_ino) == _header->inode && st.st_size > 0)
+		log_map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (log_map == MAP_FAILED)
+		return;
+	const char* base = static_cast<const char*>(log_map);
+	alert a;
+	for (const entry* e = begin; e != stop && e->time < end; ++e)
+	{
+		if (e->host != host || (service && e->service != service) || e->offset + e->length > static_cast<uint64_t>(st.st_size))
+			continue;
+		const char* line_end = base + e->offset + e->length;
+		if (!parse_alert(base + e->offset, line_end, a) || host_name.compare(0, string::npos, a.host, a.host_length) != 0 ||
+			(service && service_description.compare(0, string::npos, a.service, a.service_length) != 0))
+			continue;
+		json event;
+		map<string, json>& m(event.map_value());
+		m["time"].number_value() = a.time;
+		m["type"].string_value() = a.service ? "service" : "host";
+		if (a.service)
+			m["service"].string_value().assign(a.service, a.service_length);
+		// state;type;attempt;output, the output possibly containing semicolons.
+		const char* p = a.rest;
+		static const char* const fields[] = { "state", "state_type", "attempt" };
+		for (unsigned i(0); i < 3; ++i)
+		{
+			const char* semicolon = static_cast<const char*>(memchr(p, ';', line_end - p));
+			const char* field_end = semicolon ? semicolon : line_end;
+			if (i == 2)
+				m[fields[i]].number_value() = strtol(string(p, field_end).c_str(), nullptr, 10);
+			else
+				m[fields[i]].string_value().assign(p, field_end);
+			p = semicolon ? semicolon + 1 : line_end;
+		}
+		m["output"].string_value().assign(p, line_end);
+		events.push_back(move(event));
+	}
+	munmap(log_map, st.st_size);
+}
+
+json log_index::stats() const
+{
+	json j;
+	map<string, json>& map(j.map_value());
+	if (!_map)
+		return j;
+	map["alerts"].number_value() = static_cast<double>(_count);
+	map["first"].number_value() = static_cast<double>(first());
+	map["last"].number_value() = static_cast<double>(last());
+	map["indexed_bytes"].number_value() = static_cast<double>(_header->indexed);
+	return j;
+}
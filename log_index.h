@@ -0,0 +1,53 @@
+#ifndef __LOG_INDEX_H
+#define __LOG_INDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "json.h"
+
+// Index of the alerts of a Nagios log (nagios.log or one of its archives),
+// kept in a sidecar file: for every HOST ALERT and SERVICE ALERT line, its
+// time, hashes of its host and service, and where it lies in the log. It is
+// extended by whoever opens it after the log grew, and rebuilt once the log
+// was rotated. Entries are in log order, hence in time order, so that a time
+// range is found by binary search and only the lines of the requested host
+// or service are read from the log.
+class log_index
+{
+private:
+	struct header;
+	struct entry;
+
+	std::string _log_path;
+	void* _map;
+	std::size_t _size;
+	const header* _header;
+	const entry* _entries;
+	std::uint64_t _count; // as of mapping, the index being appended to
+
+	bool attach(int fd);
+
+public:
+	log_index() : _log_path(), _map(nullptr), _size(0), _header(nullptr), _entries(nullptr), _count(0) { }
+	~log_index();
+
+	// Brings the index at index_path up to date with the log at log_path,
+	// creating it if need be, then maps it. An index that cannot be written
+	// is used as it is.
+	bool open(const std::string& log_path, const std::string& index_path);
+
+	inline std::uint64_t count() const { return _count; }
+	std::time_t first() const;
+	std::time_t last() const;
+
+	// Appends the alerts of host_name between start and end, only those of
+	// service_description unless it is empty.
+	void query(const std::string& host_name, const std::string& service_description, std::time_t start, std::time_t end, std::vector<json>& events) const;
+	json stats() const;
+};
+
+#endif
@@ -2,171 +2,770 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <map>
+#include <set>
+#include <iterator>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
 
-#include "json.h"
-#include "nagios_host.h"
-#include "nagios_perfdata.h"
-#include "nagios_service.h"
+#include <dirent.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "file_watcher.h"
+#include "host_filter.h"
+#include "http_server.h"
+#include "latency_histogram.h"
+#include "log_index.h"
+#include "nagios_snapshot.h"
+#include "openmetrics.h"
+#include "perfdata_history.h"
+#include "response_cache.h"
+#include "serializer.h"
+#include "snapshot_image.h"
 #include "string_map.h"
 #include "strutil.h"
 
 using namespace std;
 
-map<string, nagios_host> hosts;
 string_map configuration;
 string_map environment;
 
-inline nagios_host& host(const string& host_name)
+// instances.<name>.status-file, instances.<name>.objects-file and
+// instances.<name>.host-prefix, merged in name order; status-file and
+// objects-file alone otherwise.
+vector<nagios_instance> instances()
+{
+	vector<nagios_instance> list;
+	string_map::const_iterator end = configuration.end();
+	for (string_map::const_iterator it = configuration.lower_bound("instances."); it != end && starts_with(it->first, "instances."); ++it)
+	{
+		const string& k = it->first;
+		if (k.size() > 22 && k.compare(k.size() - 12, 12, ".status-file") == 0)
+		{
+			string name(k.substr(10, k.size() - 22));
+			list.push_back(nagios_instance(it->second, configuration["instances." + name + ".objects-file"], configuration["instances." + name + ".host-prefix"]));
+		}
+	}
+	if (list.empty())
+		list.push_back(nagios_instance(configuration["status-file"], configuration["objects-file"], string()));
+	return list;
+}
+vector<string> sources()
+{
+	vector<nagios_instance> list(instances());
+	vector<string> files;
+	vector<nagios_instance>::const_iterator end = list.end();
+	for (vector<nagios_instance>::const_iterator it = list.begin(); it != end; ++it)
+	{
+		files.push_back(it->status_file());
+		files.push_back(it->objects_file());
+	}
+	return files;
+}
+unsigned long config_number(const string& key, unsigned long default_value)
 {
-	nagios_host& hst = hosts[host_name];
-	if (host_name.size() != 0 && hst.host_name().size() == 0)
-		hst.host_name() = host_name;
-	return hst;
+	const string& value = configuration[key];
+	return value.size() ? strtoul(value.c_str(), nullptr, 10) : default_value;
 }
 
-void fill_status(nagios_service& svc, map<string, string>& data)
+// Query parameters selecting what a response shows. Others are ignored and
+// do not make for separate cache entries.
+const char* const view_parameters[] = { "summary", "hosts", "limit", "after", "metrics", "columns", "problems", nullptr };
+
+string_map view_of(const string_map& query)
+{
+	string_map view;
+	for (const char* const* name = view_parameters; *name; ++name)
+	{
+		string_map::const_iterator it = query.find(*name);
+		if (it != query.end())
+			view.insert(*it);
+	}
+	return view;
+}
+// ?limit, digits only, or default_value without one. Too large a number
+// gives ULONG_MAX.
+bool limit_of(const string_map& view, unsigned long default_value, unsigned long& limit)
+{
+	string_map::const_iterator it = view.find("limit");
+	limit = default_value;
+	if (it == view.end())
+		return true;
+	if (it->second.empty() || it->second.find_first_not_of("0123456789") != string::npos)
+		return false;
+	limit = strtoul(it->second.c_str(), nullptr, 10);
+	return true;
+}
+// Whether the view parameters can be rendered, otherwise a bad request.
+bool valid_view(const string_map& view)
+{
+	unsigned long limit;
+	return limit_of(view, 0, limit);
+}
+// ?ndjson asks for newline-delimited JSON, whatever the Accept header says.
+serialization_format format_of(const string& accept, const string_map& query)
+{
+	return query.count("ndjson") ? format_ndjson : negotiate_format(accept);
+}
+// ?problems shows at most this many, whatever limit says.
+const unsigned long max_problems = 10000;
+json render(const nagios_snapshot& snapshot, const host_filter& filter, const string_map& view)
 {
-	svc.current_state() = stoi(data["current_state"]);
-	svc.state_type() = stoi(data["state_type"]);
-	svc.plugin_output() = data["plugin_output"];
-	nagios_perfdata::parse_all(svc.performance_data(), data["performance_data"]);
-	svc.is_flapping() = stoi(data["is_flapping"]) != 0;
+	if (view.count("summary"))
+		return snapshot.generate_summary(filter, view.count("hosts") != 0);
+	unsigned long limit;
+	// ?problems shows 50 of them unless limit says otherwise.
+	if (view.count("problems"))
+	{
+		limit_of(view, 50, limit);
+		return snapshot.generate_problems(filter, limit < max_problems ? limit : max_problems);
+	}
+	if (limit_of(view, 0, limit) && limit > 0)
+	{
+		string_map::const_iterator after = view.find("after");
+		return snapshot.generate_page(filter, after != view.end() ? after->second : string(), limit);
+	}
+	return snapshot.generate_json(filter);
+}
+// ?metrics is OpenMetrics text, whatever the negotiated format.
+const char* content_type_of(const serializer& out, const string_map& view)
+{
+	return view.count("metrics") ? openmetrics_writer::content_type : out.content_type();
+}
+void render_to(ostream& os, serialization_format format, const nagios_snapshot& snapshot, const host_filter& filter, const string_map& view)
+{
+	if (view.count("metrics"))
+	{
+		snapshot.write_metrics(filter, os);
+		return;
+	}
+	unique_ptr<serializer> out(make_serializer(format, os));
+	if (view.count("columns"))
+		snapshot.write_columns(filter, *out);
+	else if (view.empty())
+		snapshot.write_json(filter, *out, config_number("render-threads", thread::hardware_concurrency() ? thread::hardware_concurrency() : 1));
+	else
+		out->write(render(snapshot, filter, view));
+	out->finish();
 }
-void fill_object(nagios_host& hst, map<string, string>& data)
+// Pages and limited views are rendered each time: a client walking limit
+// and after values would otherwise add a cache entry for each.
+bool cacheable(const string_map& view)
 {
-	hst.alias() = data["alias"];
-	hst.display_name() = data["display_name"];
-	hst.icon_image() = data["icon_image"];
+	return !view.count("limit") && !view.count("after");
+}
+string cache_variant(serialization_format format, const host_filter& filter, const string_map& view)
+{
+	string variant(to_string(format) + "\n" + filter.key());
+	string_map::const_iterator end = view.end();
+	for (string_map::const_iterator it = view.begin(); it != end; ++it)
+		variant += "\n" + it->first + "=" + it->second;
+	return variant;
 }
 
-void read_status(istream& file)
+// Maps the image published by the watch mode if it is current, reads the
+// Nagios files otherwise. Either way, only what the filter shows is kept.
+void load(nagios_snapshot& snapshot, const host_filter& filter)
 {
-	bool in_object = false, shall_store = false;
-	map<string, string> object_data;
-	string object_type;
-	string s, k, v;
-	string::size_type pos = string::npos;
-	while (getline(file, s))
+	const string& image_file = configuration["snapshot-file"];
+	if (image_file.size())
 	{
-		trim(s);
-		if (!s.size())
-			continue;
-		if (!in_object)
+		snapshot_image image;
+		if (image.open(image_file, response_cache::generation(sources())))
 		{
-			if (s.size() > 2 && s.substr(pos = s.size() - 2) == " {")
-			{
-				in_object = true;
-				object_type = s.substr(0, pos);
-				shall_store = object_type == "hoststatus" || object_type == "servicestatus";
-			}
+			if (image.load(snapshot, filter))
+				return;
+			snapshot = nagios_snapshot();
 		}
-		else
+	}
+	snapshot.load(instances(), filter);
+}
+
+// Returns a descriptor on the cached response, rendering it first if the
+// cache has none for the current generation; -1 if the cache is unusable,
+// or if the render could not be written whole, in which case nothing is
+// cached and the caller renders again for itself.
+int render_cached(response_cache& cache, serialization_format format, const host_filter& filter, const string_map& view, nagios_snapshot& snapshot, bool& loaded)
+{
+	int fd = cache.open();
+	if (fd < 0 && cache.lock() && (fd = cache.open()) < 0)
+	{
+		ofstream file(cache.temp_path());
+		if (file)
 		{
-			if (s.size() == 1 && s[0] == '}')
+			if (!loaded)
 			{
-				if (object_type == "hoststatus")
-				{
-					if (stoi(object_data["active_checks_enabled"]) != 0 && object_data["check_period"] != "" && object_data["check_period"] != "none")
-						fill_status(host(object_data["host_name"]).service("Ping"), object_data);
-				}
-				else if (object_type == "servicestatus")
-					fill_status(host(object_data["host_name"]).service(object_data["service_description"]), object_data);
-				object_data.clear();
-				in_object = false;
+				load(snapshot, filter);
+				loaded = true;
 			}
-			else if (shall_store && (pos = s.find('=')) != string::npos)
+			try
 			{
-				k = s.substr(0, pos);
-				v = s.substr(pos + 1);
-				trim(k);
-				trim(v);
-				object_data[k] = v;
+				render_to(file, format, snapshot, filter, view);
 			}
+			catch (...)
+			{
+				file.close();
+				cache.abandon();
+				throw;
+			}
+			file.close();
+			if (file)
+				fd = cache.commit();
+			else
+				cache.abandon();
 		}
 	}
+	return fd;
 }
-void read_objects(istream& file)
+
+// Keeps the cache filled for every configured user and the snapshot image
+// published, re-rendering as soon as Nagios rewrites its files instead of
+// when the next request comes in.
+int watch()
 {
-	bool in_object = false, shall_store = false;
-	map<string, string> object_data;
-	string object_type;
-	string s, k, v;
-	string::size_type pos = string::npos;
-	while (getline(file, s))
+	const string& cache_dir = configuration["cache-dir"];
+	const string& history_file = configuration["history-file"];
+	const string& image_file = configuration["snapshot-file"];
+	if (!cache_dir.size() && !history_file.size() && !image_file.size())
 	{
-		trim(s);
-		if (!s.size())
-			continue;
-		if (!in_object)
+		cerr << "Watch mode needs cache-dir, history-file or snapshot-file to be configured" << endl;
+		return 1;
+	}
+	perfdata_history history;
+	if (history_file.size())
+	{
+		unsigned long metrics = config_number("history-metrics", 16384), samples = config_number("history-samples", 360);
+		if (!history.create(history_file, metrics, samples))
 		{
-			if (s.size() > 9 && s.substr(0, 7) == "define " && s.substr(pos = s.size() - 2) == " {")
-			{
-				in_object = true;
-				object_type = s.substr(7, pos - 7);
-				shall_store = object_type == "host";
-			}
+			cerr << "Cannot create " << history_file << " for " << metrics << " metrics of " << samples << " samples" << endl;
+			return 1;
 		}
-		else
+		cerr << "Perfdata history: " << history.stats() << endl;
+	}
+	vector<string> files(sources());
+	file_watcher watcher;
+	vector<string>::const_iterator fend = files.end();
+	for (vector<string>::const_iterator it = files.begin(); it != fend; ++it)
+		if (!watcher.add(*it))
 		{
-			if (s.size() == 1 && s[0] == '}')
-			{
-				if (object_type == "host")
-					fill_object(host(object_data["host_name"]), object_data);
-				object_data.clear();
-				in_object = false;
-			}
-			else if (shall_store && (pos = s.find('\t')) != string::npos)
+			cerr << "Cannot watch " << *it << endl;
+			return 1;
+		}
+	map<string, host_filter> filters;
+	filters[host_filter().key()] = host_filter();
+	string_map::const_iterator cend = configuration.end();
+	for (string_map::const_iterator it = configuration.begin(); it != cend; ++it)
+	{
+		const string& k = it->first;
+		string::size_type dot;
+		if (starts_with(k, "users.") && (dot = k.find('.', 6)) != string::npos)
+		{
+			host_filter filter(host_filter::for_user(configuration, k.substr(6, dot - 6)));
+			filters[filter.key()] = filter;
+		}
+	}
+	vector<string_map> views(2);
+	views[1]["summary"] = string();
+	for (; ; )
+	{
+		vector<unique_ptr<response_cache> > caches;
+		map<string, host_filter>::const_iterator end = filters.end();
+		vector<string_map>::const_iterator vend = views.end();
+		if (cache_dir.size())
+			for (map<string, host_filter>::const_iterator it = filters.begin(); it != end; ++it)
+				for (vector<string_map>::const_iterator view = views.begin(); view != vend; ++view)
+					caches.emplace_back(new response_cache(cache_dir, files, cache_variant(format_json, it->second, *view)));
+		string generation(response_cache::generation(files));
+		nagios_snapshot snapshot;
+		snapshot.load(instances());
+		bool loaded = true;
+		if (image_file.size() && !snapshot_image::publish(image_file, generation, snapshot))
+			cerr << "Cannot publish " << image_file << endl;
+		if (history_file.size())
+			history.record(snapshot, time(nullptr));
+		vector<unique_ptr<response_cache> >::iterator cache = caches.begin();
+		for (map<string, host_filter>::const_iterator it = filters.begin(); cache != caches.end(); ++it)
+			for (vector<string_map>::const_iterator view = views.begin(); view != vend; ++view, ++cache)
 			{
-				k = s.substr(0, pos);
-				v = s.substr(pos + 1);
-				trim(k);
-				trim(v);
-				object_data[k] = v;
+				int fd = render_cached(**cache, format_json, it->second, *view, snapshot, loaded);
+				if (fd >= 0)
+					close(fd);
 			}
+		if (!watcher.wait(250, 2000))
+			return 1;
+	}
+}
+
+void write_headers(const char* content_type, const char* status = "200 OK")
+{
+	cout << "Status: " << status << endl;
+	cout << "Content-Type: " << content_type << endl;
+	cout << "Vary: Accept" << endl;
+	cout << "Cache-Control: no-cache, no-store, must-revalidate" << endl;
+	cout << "Pragma: no-cache" << endl;
+	cout << "Expires: 0" << endl;
+	cout << endl;
+}
+
+// Whether a user with this filter may see the host, whose name includes
+// the filter's host prefix.
+bool host_visible(const host_filter& filter, const string& host_name)
+{
+	if (!filter.alias_prefix().size() && !filter.display_prefix().size())
+		return true;
+	nagios_snapshot objects;
+	objects.load_objects(instances());
+	nagios_snapshot::host_map::size_type i = objects.hosts().find(host_name);
+	return i != nagios_snapshot::host_map::npos && filter.visible(objects.hosts()[i]);
+}
+
+// ?history gives the history file usage; with host, service and label, it
+// gives the metric's samples between start and end (UNIX times, the last
+// hour by default) reduced to a number of buckets. Returns the HTTP status.
+const char* history(string_map& query, const host_filter& filter, json& j)
+{
+	perfdata_history history;
+	const char* status = "200 OK";
+	if (!history.open(configuration["history-file"]))
+		status = "503 Service Unavailable";
+	else if (!query.count("host"))
+		j = history.stats();
+	else
+	{
+		string host_name(filter.host_prefix() + query["host"]);
+		if (!host_visible(filter, host_name))
+			status = "404 Not Found";
+		else
+		{
+			time_t end = query["end"].size() ? strtoll(query["end"].c_str(), nullptr, 10) : time(nullptr);
+			time_t start = query["start"].size() ? strtoll(query["start"].c_str(), nullptr, 10) : end - 3600;
+			unsigned long buckets = query["buckets"].size() ? strtoul(query["buckets"].c_str(), nullptr, 10) : 60;
+			if (buckets > 1000)
+				buckets = 1000;
+			j = history.query(perfdata_history::key(host_name, query["service"], query["label"]), start, end, buckets);
 		}
 	}
+	return status;
 }
 
-json generate_json(const string& host_prefix, const string& alias_prefix, const string& display_prefix)
+// log-file and the archives in log-archive-dir, oldest first, with the
+// paths of their indexes in log-index-dir.
+vector<pair<string, string> > logs()
 {
-	string::size_type host_prefix_len = host_prefix.size();
-	string::size_type alias_prefix_len = alias_prefix.size();
-	string::size_type display_prefix_len = display_prefix.size();
-	json j;
-	vector<json>& vec = j.vector_value();
-	map<string, nagios_host>::iterator end = hosts.end();
-	for (map<string, nagios_host>::iterator it = hosts.begin(); it != end; ++it)
-	{
-		nagios_host& host = it->second;
-		if (host.services().size() &&
-			(!host_prefix_len || starts_with(host.host_name(), host_prefix)) &&
-			(!alias_prefix_len || starts_with(host.alias(), alias_prefix)) &&
-			(!display_prefix_len || starts_with(host.display_name(), display_prefix))) {
-			if (host_prefix_len)
-				trim(host.host_name() = host.host_name().substr(host_prefix_len));
-			if (alias_prefix_len)
-				trim(host.alias() = host.alias().substr(alias_prefix_len));
-			if (display_prefix_len)
-				trim(host.display_name() = host.display_name().substr(display_prefix_len));
-			vec.emplace_back(host);
+	vector<pair<string, string> > list;
+	const string& log_file = configuration["log-file"];
+	const string& archive_dir = configuration["log-archive-dir"];
+	const string& index_dir = configuration["log-index-dir"];
+	if (!log_file.size() || !index_dir.size())
+		return list;
+	// nagios-MM-DD-YYYY-HH.log, sorted as YYYYMM-DD-HH.
+	map<string, string> archives;
+	DIR* dir = archive_dir.size() ? opendir(archive_dir.c_str()) : nullptr;
+	if (dir)
+	{
+		struct dirent* e;
+		while ((e = readdir(dir)))
+		{
+			string name(e->d_name);
+			if (name.size() < 4 || name.compare(name.size() - 4, 4, ".log") != 0)
+				continue;
+			string::size_type date = name.size() >= 17 ? name.size() - 17 : 0;
+			archives[name.size() >= 17 ? name.substr(date + 6, 4) + name.substr(date, 6) + name.substr(date + 11, 2) + name : name] = name;
+		}
+		closedir(dir);
+	}
+	for (map<string, string>::const_iterator it = archives.begin(); it != archives.end(); ++it)
+		list.push_back(make_pair(archive_dir + "/" + it->second, index_dir + "/" + it->second + ".idx"));
+	string::size_type slash = log_file.rfind('/');
+	list.push_back(make_pair(log_file, index_dir + "/" + log_file.substr(slash == string::npos ? 0 : slash + 1) + ".idx"));
+	return list;
+}
+
+// How ?events names a log, its path being none of a user's business:
+// "current" for log-file, YYYY-MM-DD-HH for nagios-MM-DD-YYYY-HH.log, and
+// the file name without .log for another archive.
+string log_name(const string& path, bool current)
+{
+	if (current)
+		return "current";
+	string::size_type slash = path.rfind('/');
+	string name(path.substr(slash == string::npos ? 0 : slash + 1));
+	name.erase(name.size() - 4);
+	const char* pattern = "nagios-dd-dd-dddd-dd";
+	if (name.size() != strlen(pattern))
+		return name;
+	for (string::size_type i = 0; i < name.size(); ++i)
+		if (pattern[i] == 'd' ? name[i] < '0' || name[i] > '9' : name[i] != pattern[i])
+			return name;
+	return name.substr(13, 4) + "-" + name.substr(7, 5) + name.substr(17);
+}
+
+// ?events gives the indexed logs, by log_name(); with host, and optionally service, it
+// gives the alerts Nagios logged for them between start and end (UNIX
+// times, the last day by default), oldest first, at most the latest limit.
+// Indexes are brought up to date as the logs grow. Returns the HTTP status.
+const char* events(string_map& query, const host_filter& filter, json& j)
+{
+	vector<pair<string, string> > files(logs());
+	if (files.empty())
+		return "503 Service Unavailable";
+	if (!query.count("host"))
+	{
+		map<string, json>& m(j.map_value());
+		for (vector<pair<string, string> >::const_iterator it = files.begin(); it != files.end(); ++it)
+		{
+			log_index index;
+			if (index.open(it->first, it->second))
+				m[log_name(it->first, it + 1 == files.end())] = index.stats();
 		}
+		return "200 OK";
 	}
+	unsigned long limit;
+	if (!limit_of(query, 1000, limit))
+		return "400 Bad Request";
+	string host_name(filter.host_prefix() + query["host"]);
+	if (!host_visible(filter, host_name))
+		return "404 Not Found";
+	time_t end = query["end"].size() ? strtoll(query["end"].c_str(), nullptr, 10) : time(nullptr);
+	time_t start = query["start"].size() ? strtoll(query["start"].c_str(), nullptr, 10) : end - 86400;
+	if (limit > 100000)
+		limit = 100000;
+	vector<json>& list(j.vector_value());
+	// Only the indexes of the archives are opened that might hold the range:
+	// an archive ends where the next file starts.
+	for (vector<pair<string, string> >::size_type i(files.size()); i-- > 0; )
+	{
+		log_index index;
+		if (!index.open(files[i].first, files[i].second) || !index.count())
+			continue;
+		if (index.first() < end)
+		{
+			vector<json> found;
+			index.query(host_name, query["service"], start, end, found);
+			list.insert(list.begin(), make_move_iterator(found.begin()), make_move_iterator(found.end()));
+		}
+		if (index.first() < start || list.size() >= limit)
+			break;
+	}
+	if (list.size() > limit)
+		list.erase(list.begin(), list.end() - limit);
+	return "200 OK";
+}
+
+// Requests answered from something else than the snapshot.
+typedef const char* (*endpoint)(string_map& query, const host_filter& filter, json& j);
+endpoint endpoint_of(const string_map& query)
+{
+	if (query.count("history"))
+		return history;
+	if (query.count("events"))
+		return events;
+	return nullptr;
+}
+
+// Percentiles of a histogram of durations, in milliseconds.
+json percentiles(const latency_histogram& h)
+{
+	json j;
+	map<string, json>& m(j.map_value());
+	m["mean"].number_value() = h.mean() / 1e6;
+	m["p50"].number_value() = h.percentile(0.5) / 1e6;
+	m["p90"].number_value() = h.percentile(0.9) / 1e6;
+	m["p99"].number_value() = h.percentile(0.99) / 1e6;
+	m["p999"].number_value() = h.percentile(0.999) / 1e6;
+	m["max"].number_value() = h.maximum() / 1e6;
 	return j;
 }
-void write_json(const char* to_file, const string& host_prefix, const string& alias_prefix, const string& display_prefix)
+// ?stats on the server: requests answered since it started, their rate,
+// latency and handler CPU time, and the malformed values in the snapshot.
+json server_stats(const http_statistics& s, const parse_errors& errors)
 {
-	ofstream file(to_file);
-	file << generate_json(host_prefix, alias_prefix, display_prefix);
+	json j;
+	map<string, json>& m(j.map_value());
+	m["requests"].number_value() = s.latency.count();
+	m["seconds"].number_value() = s.seconds;
+	m["requests_per_second"].number_value() = s.seconds > 0 ? s.latency.count() / s.seconds : 0;
+	m["latency"] = percentiles(s.latency);
+	m["cpu"] = percentiles(s.cpu);
+	m["parse_errors"] = errors;
+	return j;
+}
+
+// A loaded snapshot and the responses rendered from it, replaced as a whole
+// and never modified but for the cache. A variant is rendered once: requests
+// for it that come meanwhile wait for that render. Past the bounds, further
+// variants are rendered for each request and not kept.
+struct published_snapshot
+{
+	static const map<string, http_response>::size_type max_responses = 256;
+	static const string::size_type max_response_bytes = 512 << 20;
+
+	nagios_snapshot snapshot;
+	mutex lock;
+	condition_variable rendered;
+	map<string, http_response> responses;
+	string::size_type response_bytes;
+	set<string> rendering;
+
+	published_snapshot() : snapshot(), lock(), rendered(), responses(), response_bytes(0), rendering() { }
+};
+
+// Serves HTTP itself, from a snapshot kept in memory. Cached responses are
+// sent by the event loop, others rendered by a pool of workers. When Nagios
+// rewrites its files, the next snapshot is loaded on a thread of its own and
+// swapped in atomically, requests keeping the one they started with. The old
+// snapshot is freed by whichever of them is done last.
+int serve()
+{
+	const string& address = configuration["listen"];
+	http_server server(config_number("workers", thread::hardware_concurrency() ? thread::hardware_concurrency() : 1));
+	if (!server.listen(address))
+	{
+		cerr << "Cannot listen on " << address << endl;
+		return 1;
+	}
+	vector<string> files(sources());
+	file_watcher watcher;
+	vector<string>::const_iterator fend = files.end();
+	for (vector<string>::const_iterator it = files.begin(); it != fend; ++it)
+		if (!watcher.add(*it))
+		{
+			cerr << "Cannot watch " << *it << endl;
+			return 1;
+		}
+	int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer < 0)
+		return 1;
+	// Workers only read the configuration: the keys they look up have all
+	// been created by now, by sources() and below.
+	configuration["history-file"];
+	configuration["render-threads"];
+	configuration["log-file"];
+	configuration["log-archive-dir"];
+	configuration["log-index-dir"];
+	map<string, host_filter> filters;
+	string_map::const_iterator cend = configuration.end();
+	for (string_map::const_iterator it = configuration.begin(); it != cend; ++it)
+	{
+		const string& k = it->first;
+		string::size_type dot;
+		if (starts_with(k, "users.") && (dot = k.find('.', 6)) != string::npos)
+			filters[k.substr(6, dot - 6)];
+	}
+	for (map<string, host_filter>::iterator it = filters.begin(); it != filters.end(); ++it)
+		it->second = host_filter::for_user(configuration, it->first);
+	shared_ptr<published_snapshot> current(new published_snapshot());
+	current->snapshot.load(instances());
+	mutex reload_lock;
+	condition_variable reload_requested;
+	bool reload = false, stopping = false;
+	thread loader([&]()
+	{
+		// Snapshots replaced, kept until the last request using them is
+		// over, so that this thread, not the loop, gets to destroy them.
+		vector<shared_ptr<published_snapshot>> retired;
+		for (; ; )
+		{
+			bool load;
+			{
+				unique_lock<mutex> lock(reload_lock);
+				if (!reload && !stopping)
+				{
+					if (retired.empty())
+						reload_requested.wait(lock);
+					else
+						reload_requested.wait_for(lock, chrono::milliseconds(100));
+				}
+				if (stopping)
+					return;
+				load = reload;
+				reload = false;
+			}
+			for (vector<shared_ptr<published_snapshot>>::iterator it = retired.begin(); it != retired.end(); )
+				if (it->use_count() == 1)
+					it = retired.erase(it);
+				else
+					++it;
+			if (!load)
+				continue;
+			shared_ptr<published_snapshot> next(new published_snapshot());
+			next->snapshot.load(instances());
+			retired.push_back(atomic_exchange(&current, next));
+		}
+	});
+	// Reload once no event came for 250 ms, or 2 s after the first one.
+	chrono::steady_clock::time_point first_change;
+	bool changed = false;
+	server.watch(watcher.fd(), [&]()
+	{
+		if (!watcher.drain())
+			return;
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (!changed)
+			first_change = now;
+		changed = true;
+		long long left = 2000 - chrono::duration_cast<chrono::milliseconds>(now - first_change).count();
+		long long delay = left < 250 ? (left > 1 ? left : 1) : 250;
+		struct itimerspec spec;
+		memset(&spec, 0, sizeof(spec));
+		spec.it_value.tv_sec = delay / 1000;
+		spec.it_value.tv_nsec = delay % 1000 * 1000000;
+		timerfd_settime(timer, 0, &spec, nullptr);
+	});
+	server.watch(timer, [&]()
+	{
+		uint64_t expirations;
+		if (read(timer, &expirations, sizeof(expirations)) != sizeof(expirations))
+			return;
+		changed = false;
+		lock_guard<mutex> lock(reload_lock);
+		reload = true;
+		reload_requested.notify_one();
+	});
+	const string& user_header = configuration["remote-user-header"];
+	const string& default_user = configuration["remote-user"];
+	// What a request asks for, and the key of its response in the cache.
+	auto parse = [&](const http_request& request, host_filter& filter, serialization_format& format, string_map& query) -> string
+	{
+		string_map::const_iterator user = user_header.size() ? request.headers.find(user_header) : request.headers.end();
+		map<string, host_filter>::const_iterator filter_it = filters.find(user != request.headers.end() ? user->second : default_user);
+		if (filter_it != filters.end())
+			filter = filter_it->second;
+		string::size_type mark = request.target.find('?');
+		if (mark != string::npos)
+			parse_query_string(query, request.target.substr(mark + 1));
+		string_map::const_iterator accept = request.headers.find("accept");
+		format = format_of(accept != request.headers.end() ? accept->second : string(), query);
+		return cache_variant(format, filter, view_of(query));
+	};
+	int result = server.run([&](const http_request& request, http_response& response)
+	{
+		host_filter filter;
+		serialization_format format;
+		string_map query;
+		string variant(parse(request, filter, format, query));
+		ostringstream body;
+		unique_ptr<serializer> out(make_serializer(format, body));
+		response.content_type = out->content_type();
+		response.status = "200 OK";
+		endpoint e = endpoint_of(query);
+		if (e)
+		{
+			json j;
+			response.status = e(query, filter, j);
+			out->write(j);
+			out->finish();
+			response.body = make_shared<const string>(body.str());
+			return;
+		}
+		string_map view(view_of(query));
+		if (!valid_view(view))
+		{
+			response.status = "400 Bad Request";
+			out->write(json());
+			out->finish();
+			response.body = make_shared<const string>(body.str());
+			return;
+		}
+		response.content_type = content_type_of(*out, view);
+		shared_ptr<published_snapshot> published(atomic_load(&current));
+		bool keep;
+		{
+			unique_lock<mutex> lock(published->lock);
+			while (published->rendering.count(variant))
+				published->rendered.wait(lock);
+			map<string, http_response>::const_iterator cached = published->responses.find(variant);
+			if (cached != published->responses.end())
+			{
+				response = cached->second;
+				return;
+			}
+			keep = cacheable(view) && published->responses.size() + published->rendering.size() < published_snapshot::max_responses && published->response_bytes < published_snapshot::max_response_bytes;
+			if (keep)
+				published->rendering.insert(variant);
+		}
+		try
+		{
+			render_to(body, format, published->snapshot, filter, view);
+			response.body = make_shared<const string>(body.str());
+		}
+		catch (...)
+		{
+			if (keep)
+			{
+				lock_guard<mutex> lock(published->lock);
+				published->rendering.erase(variant);
+				published->rendered.notify_all();
+			}
+			throw;
+		}
+		if (!keep)
+			return;
+		lock_guard<mutex> lock(published->lock);
+		published->rendering.erase(variant);
+		published->responses.insert(make_pair(variant, response));
+		published->response_bytes += response.body->size();
+		published->rendered.notify_all();
+	}, [&](const http_request& request, http_response& response)
+	{
+		host_filter filter;
+		serialization_format format;
+		string_map query;
+		string variant(parse(request, filter, format, query));
+		if (query.count("stats"))
+		{
+			ostringstream body;
+			unique_ptr<serializer> out(make_serializer(format, body));
+			out->write(server_stats(server.statistics(), atomic_load(&current)->snapshot.errors()));
+			out->finish();
+			response.status = "200 OK";
+			response.content_type = out->content_type();
+			response.body = make_shared<const string>(body.str());
+			return true;
+		}
+		if (endpoint_of(query))
+			return false;
+		shared_ptr<published_snapshot> published(atomic_load(&current));
+		lock_guard<mutex> lock(published->lock);
+		map<string, http_response>::const_iterator cached = published->responses.find(variant);
+		if (cached == published->responses.end())
+			return false;
+		response = cached->second;
+		return true;
+	});
+	{
+		lock_guard<mutex> lock(reload_lock);
+		stopping = true;
+		reload_requested.notify_one();
+	}
+	loader.join();
+	return result;
 }
 
 int main(int argc, char** argv, char** envp)
 {
-	if (argc != 1 && argc != 2)
+	string mode(argc > 1 && argv[1][0] == '-' ? argv[1] : "");
+	if (mode.size())
+	{
+		--argc;
+		++argv;
+	}
+	if ((argc != 1 && argc != 2) || (mode.size() && mode != "-w" && mode != "-s"))
 	{
-		cerr << "Usage : " << argv[0] << " [config-file]" << endl;
+		cerr << "Usage : " << argv[0] << " [-w|-s] [config-file]" << endl;
 		return 1;
 	}
 	parse_string_map(environment, envp);
@@ -185,28 +784,70 @@ int main(int argc, char** argv, char** envp)
 		ifstream cfgstream(cfgfile);
 		parse_string_map(configuration, cfgstream);
 	}
+	if (mode == "-w")
+		return watch();
+	if (mode == "-s")
+		return serve();
+	string_map::iterator SERVER_PROTOCOL = environment.find("SERVER_PROTOCOL");
+	bool cgi = SERVER_PROTOCOL != environment.end();
+	string_map query;
+	parse_query_string(query, environment["QUERY_STRING"]);
+	serialization_format format = format_of(environment["HTTP_ACCEPT"], query);
+	host_filter filter(host_filter::for_user(configuration, environment["REMOTE_USER"]));
+	unique_ptr<serializer> out(make_serializer(format, cout));
+	endpoint e = endpoint_of(query);
+	if (e)
+	{
+		json j;
+		const char* status = e(query, filter, j);
+		if (cgi)
+			write_headers(out->content_type(), status);
+		out->write(j);
+		out->finish();
+		return 1;
+	}
+	string_map view(view_of(query));
+	if (!valid_view(view))
 	{
-		ifstream ifs(configuration["status-file"]);
-		read_status(ifs);
+		if (cgi)
+			write_headers(out->content_type(), "400 Bad Request");
+		out->write(json());
+		out->finish();
+		return 1;
 	}
+	nagios_snapshot snapshot;
+	bool loaded = false;
+	const string& cache_dir = configuration["cache-dir"];
+	if (cache_dir.size() && cacheable(view))
 	{
-		ifstream ifs(configuration["objects-file"]);
-		read_objects(ifs);
+		response_cache cache(cache_dir, sources(), cache_variant(format, filter, view));
+		int fd = render_cached(cache, format, filter, view, snapshot, loaded);
+		if (fd >= 0)
+		{
+			if (cgi)
+				write_headers(content_type_of(*out, view));
+			cout.flush();
+			response_cache::send(fd, STDOUT_FILENO);
+			close(fd);
+			return 1;
+		}
 	}
-	string_map::iterator SERVER_PROTOCOL = environment.find("SERVER_PROTOCOL");
-	bool cgi = SERVER_PROTOCOL != environment.end();
-	if (cgi)
+	// stream=1 writes the full list of hosts while status.dat is being read,
+	// holding one host at a time rather than all of them, in the encodings
+	// that need no count up front.
+	vector<nagios_instance> list(instances());
+	if (!loaded && view.empty() && !out->sized() && config_number("stream", 0) && list.size() == 1 && !list.front().host_prefix().size())
 	{
-		cout << "Status: 200 OK" << endl;
-		cout << "Content-Type: application/json; charset=utf-8" << endl;
-		cout << "Cache-Control: no-cache, no-store, must-revalidate" << endl;
-		cout << "Pragma: no-cache" << endl;
-		cout << "Expires: 0" << endl;
-		cout << endl;
-	}
-	cout << generate_json(
-		configuration["users." + environment["REMOTE_USER"] + ".host-prefix"],
-		configuration["users." + environment["REMOTE_USER"] + ".alias-prefix"],
-		configuration["users." + environment["REMOTE_USER"] + ".display-prefix"]) << endl;
+		if (cgi)
+			write_headers(out->content_type());
+		snapshot.stream(list.front().status_file(), list.front().objects_file(), filter, *out);
+		out->finish();
+		return 1;
+	}
+	if (!loaded)
+		load(snapshot, filter);
+	if (cgi)
+		write_headers(content_type_of(*out, view));
+	render_to(cout, format, snapshot, filter, view);
 	return 1;
 }
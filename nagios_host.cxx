@@ -2,12 +2,26 @@
 
 #include <map>
 #include <string>
+#include <vector>
 
 #include "json.h"
 #include "nagios_host.h"
 
 using namespace std;
 
+void nagios_host::sort()
+{
+	if (_services.sorted())
+		return;
+	vector<service_map::size_type> order(_services.sort());
+	vector<nagios_service_state> states;
+	states.reserve(order.size());
+	vector<service_map::size_type>::const_iterator end = order.end();
+	for (vector<service_map::size_type>::const_iterator it = order.begin(); it != end; ++it)
+		states.push_back(_states[*it]);
+	_states.swap(states);
+}
+
 nagios_host::operator json() const
 {
 	json j;
@@ -20,8 +34,9 @@ nagios_host::operator json() const
 	if (_icon_image.size())
 		map["icon_image"].string_value() = _icon_image;
 	vector<json>& j_services = map["services"].vector_value();
-	std::map<string, nagios_service>::const_iterator end = _services.end();
-	for (std::map<string, nagios_service>::const_iterator it = _services.begin(); it != end; ++it)
-		j_services.emplace_back(it->second);
+	service_map::size_type size = _services.size();
+	j_services.reserve(size);
+	for (service_map::size_type i(0); i < size; ++i)
+		j_services.emplace_back(_services[i].to_json(_states[i]));
 	return j;
 }
\ No newline at end of file
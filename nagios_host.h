@@ -1,24 +1,31 @@
 #ifndef __NAGIOS_HOST_H
 #define __NAGIOS_HOST_H
 
-#include <map>
 #include <string>
+#include <vector>
 
+#include "flat_map.h"
 #include "json.h"
 #include "nagios_service.h"
+#include "nagios_summary.h"
 
 class nagios_host
 {
+public:
+	typedef flat_map<nagios_service, &nagios_service::service_description> service_map;
+
 private:
 	std::string _name;
 	std::string _alias;
 	std::string _display_name;
 	std::string _icon_image;
-	std::map<std::string, nagios_service> _services;
+	service_map _services;
+	std::vector<nagios_service_state> _states;
+	nagios_summary _summary;
 
 public:
-	nagios_host() : _name(), _services() { }
-	explicit nagios_host(const std::string& host_name) : _name(host_name), _services() { }
+	nagios_host() : _name(), _services(), _states(), _summary() { }
+	explicit nagios_host(const std::string& host_name) : _name(host_name), _services(), _states(), _summary() { }
 
 	inline std::string& host_name() { return _name; }
 	inline const std::string& host_name() const { return _name; }
@@ -32,16 +39,28 @@ public:
 	inline std::string& icon_image() { return _icon_image; }
 	inline const std::string& icon_image() const { return _icon_image; }
 
-	inline std::map<std::string, nagios_service>& services() { return _services; }
-	inline const std::map<std::string, nagios_service>& services() const { return _services; }
+	inline service_map& services() { return _services; }
+	inline const service_map& services() const { return _services; }
 
-	inline nagios_service& service(const std::string& service_description)
+	// Parallel to services(), changed through update() to keep summary().
+	inline const std::vector<nagios_service_state>& states() const { return _states; }
+	inline const nagios_summary& summary() const { return _summary; }
+
+	inline void update(service_map::size_type i, const nagios_service_state& state)
 	{
-		nagios_service& svc = _services[service_description];
-		if (service_description.size() != 0 && svc.service_description().size() == 0)
-			svc.service_description() = service_description;
-		return svc;
+		_summary.replace(_states[i], state);
+		_states[i] = state;
 	}
+
+	inline service_map::size_type service(const std::string& service_description)
+	{
+		service_map::size_type i = _services.insert(service_description);
+		if (i == _states.size())
+			_states.emplace_back();
+		return i;
+	}
+
+	void sort();
 	
 	operator json() const;
 };
@@ -24,9 +24,11 @@ namespace
 		virtual bool is_number() const { return false; }
 		virtual bool is_string() const { return false; }
 		virtual bool is_range() const { return false; }
+		virtual bool is_error() const { return false; }
 		virtual double number_value() const { throw logic_error("Cannot get number value of non-number token"); }
 		virtual const string& string_value() const { throw logic_error("Cannot get string value of non-string token"); }
 		virtual const nagios_range& range_value() const { throw logic_error("Cannot get range value of non-range token"); }
+		virtual parse_status error_value() const { throw logic_error("Cannot get error value of non-error token"); }
 	};
 	class eos_token : public perfdata_token
 	{
@@ -76,6 +78,17 @@ namespace
 		virtual bool is_range() const { return true; }
 		virtual const nagios_range& range_value() const { return _value; }
 	};
+	class error_token : public perfdata_token
+	{
+	private:
+		parse_status _value;
+	
+	public:
+		explicit error_token(parse_status value) : _value(value) { }
+		
+		virtual bool is_error() const { return true; }
+		virtual parse_status error_value() const { return _value; }
+	};
 	
 	class perfdata_lexer : public lexer<perfdata_token, string::const_iterator>
 	{
@@ -93,8 +106,10 @@ namespace
 			min,
 			sep4,
 			max,
-			extra
+			extra,
+			failed
 		} _state;
+		parse_status _error;
 		
 		void eat_token()
 		{
@@ -102,11 +117,20 @@ namespace
 			while (_pos != _end && (c = *_pos) != ';' && !isspace(c))
 				++_pos;
 		}
+		// Every token past an error is the same error.
+		perfdata_token* fail(parse_status error)
+		{
+			_state = failed;
+			_error = error;
+			return new error_token(error);
+		}
 	
 	protected:
 		virtual perfdata_token* next()
 		{
 		start_over:
+			if (_state == failed)
+				return new error_token(_error);
 			if (eat_spaces() > 0)
 			{
 				_state = label;
@@ -126,7 +150,7 @@ namespace
 						for (; ; )
 						{
 							if (_pos == _end)
-								throw parse_error();
+								return fail(parse_bad_syntax);
 							if ((c = *_pos) == '\'')
 							{
 								++_pos;
@@ -158,7 +182,7 @@ namespace
 				}
 				case equal:
 					if (*_pos != '=')
-						throw parse_error();
+						return fail(parse_bad_syntax);
 					++_pos;
 					_state = value;
 					return new separator_token();
@@ -171,7 +195,7 @@ namespace
 						++_pos;
 					}
 					else if (!getnumber(_pos, _end, value))
-						throw parse_error();
+						return fail(parse_bad_number);
 					_state = uom;
 					return new number_token(value);
 				}
@@ -187,7 +211,7 @@ namespace
 				}
 				case sep1:
 					if (*_pos != ';')
-						throw parse_error();
+						return fail(parse_bad_syntax);
 					++_pos;
 					_state = warn;
 					return new separator_token();
@@ -196,14 +220,17 @@ namespace
 					string::const_iterator start(_pos);
 					eat_token();
 					_state = sep2;
-					if (start != _pos)
-						return new range_token(nagios_range::parse(start, _pos));
-					else // self tail-recursion
+					if (start == _pos) // self tail-recursion
 						goto start_over;
+					nagios_range range(nagios_range::empty_range);
+					parse_status status = nagios_range::parse(start, _pos, range);
+					if (status != parse_ok)
+						return fail(status);
+					return new range_token(range);
 				}
 				case sep2:
 					if (*_pos != ';')
-						throw parse_error();
+						return fail(parse_bad_syntax);
 					++_pos;
 					_state = crit;
 					return new separator_token();
@@ -212,14 +239,17 @@ namespace
 					string::const_iterator start(_pos);
 					eat_token();
 					_state = sep3;
-					if (start != _pos)
-						return new range_token(nagios_range::parse(start, _pos));
-					else // self tail-recursion
+					if (start == _pos) // self tail-recursion
 						goto start_over;
+					nagios_range range(nagios_range::empty_range);
+					parse_status status = nagios_range::parse(start, _pos, range);
+					if (status != parse_ok)
+						return fail(status);
+					return new range_token(range);
 				}
 				case sep3:
 					if (*_pos != ';')
-						throw parse_error();
+						return fail(parse_bad_syntax);
 					++_pos;
 					_state = min;
 					return new separator_token();
@@ -234,7 +264,7 @@ namespace
 				}
 				case sep4:
 					if (*_pos != ';')
-						throw parse_error();
+						return fail(parse_bad_syntax);
 					++_pos;
 					_state = max;
 					return new separator_token();
@@ -248,35 +278,44 @@ namespace
 						goto start_over;
 				}
 				case extra:
-					throw parse_error();
+					return fail(parse_bad_syntax);
 				default:
 					throw logic_error("perfdata_lexer state machine error");
 			}
 		}
 	
 	public:
-		perfdata_lexer(const string::const_iterator& begin, const string::const_iterator& end) : lexer(begin, end), _state(label) { }
+		perfdata_lexer(const string::const_iterator& begin, const string::const_iterator& end) : lexer(begin, end), _state(label), _error(parse_ok) { }
 	};
+
+	// The parser stops at the first token it does not expect, which is the
+	// error token if the lexer met one, and drops what it added before.
+	parse_status failure(perfdata_lexer& lexer, vector<nagios_perfdata>& dest, vector<nagios_perfdata>::size_type size)
+	{
+		dest.erase(dest.begin() + size, dest.end());
+		return lexer->is_error() ? lexer->error_value() : parse_bad_syntax;
+	}
 }
 
 // value = U => NAN <math.h>
 // 'label'=value[uom][;[warn][;[crit][;[min][;[max]]]]]
-void nagios_perfdata::parse_all(vector<nagios_perfdata>& dest, const string::const_iterator& begin, const string::const_iterator& end)
+parse_status nagios_perfdata::parse_all(vector<nagios_perfdata>& dest, const string::const_iterator& begin, const string::const_iterator& end)
 {
 	perfdata_lexer lexer(begin, end);
+	vector<nagios_perfdata>::size_type size = dest.size();
 	if (lexer->is_space())
 		++lexer;
 	while (!lexer->is_eos())
 	{
 		if (!lexer->is_string())
-			throw parse_error();
+			return failure(lexer, dest, size);
 		string label(lexer->string_value());
 		++lexer;
 		if (!lexer->is_separator())
-			throw parse_error();
+			return failure(lexer, dest, size);
 		++lexer;
 		if (!lexer->is_number())
-			throw parse_error();
+			return failure(lexer, dest, size);
 		double value(lexer->number_value());
 		++lexer;
 		string uom;
@@ -334,6 +373,7 @@ void nagios_perfdata::parse_all(vector<nagios_perfdata>& dest, const string::con
 		if (lexer->is_space())
 			++lexer;
 	}
+	return parse_ok;
 }
 
 nagios_perfdata::operator json() const
@@ -2,8 +2,10 @@
 #define __NAGIOS_PERFDATA_H
 
 #include <string>
+#include <vector>
 
 #include "json.h"
+#include "lexer.h"
 #include "nagios_range.h"
 
 class nagios_perfdata
@@ -41,10 +43,12 @@ public:
 	inline double& maximum() { return _maximum; }
 	inline double maximum() const { return _maximum; }
 	
-	static void parse_all(std::vector<nagios_perfdata>& destination, const std::string::const_iterator& begin, const std::string::const_iterator& end);
-	inline static void parse_all(std::vector<nagios_perfdata>& destination, const std::string& values)
+	// Appends the metrics to destination, or none of them if any is
+	// malformed.
+	static parse_status parse_all(std::vector<nagios_perfdata>& destination, const std::string::const_iterator& begin, const std::string::const_iterator& end);
+	inline static parse_status parse_all(std::vector<nagios_perfdata>& destination, const std::string& values)
 	{
-		parse_all(destination, values.begin(), values.end());
+		return parse_all(destination, values.begin(), values.end());
 	}
 	
 	operator json() const;
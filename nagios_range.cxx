@@ -50,6 +50,11 @@ namespace
 		virtual double number_value() const { return _value; }
 	};
 	
+	// Anything else; the parser stops at it, as it is none of the above.
+	class error_token : public range_token
+	{
+	};
+	
 	class range_lexer : public lexer<range_token, string::const_iterator>
 	{
 	protected:
@@ -76,7 +81,7 @@ namespace
 			else if (getnumber(_pos, _end, value))
 				return new number_token(value);
 			else
-				throw parse_error();
+				return new error_token();
 		}
 	
 	public:
@@ -91,7 +96,7 @@ const nagios_range nagios_range::empty_range(-INFINITY, INFINITY, false);
 // ~:n => nagios_range(-INFINITY, n, false)
 // n:m => nagios_range(n, m, false)
 // @n:m => nagios_range(n, m, true)
-nagios_range nagios_range::parse(const string::const_iterator& begin, const string::const_iterator& end)
+parse_status nagios_range::parse(const string::const_iterator& begin, const string::const_iterator& end, nagios_range& range)
 {
 	range_lexer lexer(begin, end);
 	bool inside = lexer->is_inside();
@@ -104,23 +109,25 @@ nagios_range nagios_range::parse(const string::const_iterator& begin, const stri
 		++lexer;
 	}
 	else
-		throw parse_error();
+		return parse_bad_range;
 	if (lexer->is_eos())
 	{
 		if (first < 0)
-			throw parse_error();
-		return nagios_range(0, first, inside);
+			return parse_bad_range;
+		range = nagios_range(0, first, inside);
+		return parse_ok;
 	}
 	else if (lexer->is_separator())
 		++lexer;
 	else
-		throw parse_error();
+		return parse_bad_range;
 	if (lexer->is_eos())
-		return nagios_range(first, INFINITY, inside);
+		range = nagios_range(first, INFINITY, inside);
 	else if (lexer->is_number() && lexer->number_value() >= first)
-		return nagios_range(first, lexer->number_value(), inside);
+		range = nagios_range(first, lexer->number_value(), inside);
 	else
-		throw parse_error();
+		return parse_bad_range;
+	return parse_ok;
 }
 
 nagios_range::operator json() const
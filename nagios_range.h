@@ -4,6 +4,7 @@
 #include <cmath>
 
 #include "json.h"
+#include "lexer.h"
 
 class nagios_range
 {
@@ -28,10 +29,11 @@ public:
 	
 	inline bool empty() const { return !(std::isfinite(_minimum) || std::isfinite(_maximum) || _inside); }
 	
-	static nagios_range parse(const std::string::const_iterator& begin, const std::string::const_iterator& end);
-	inline static nagios_range parse(const std::string& value)
+	// Leaves range as it is unless the text is a valid range.
+	static parse_status parse(const std::string::const_iterator& begin, const std::string::const_iterator& end, nagios_range& range);
+	inline static parse_status parse(const std::string& value, nagios_range& range)
 	{
-		return parse(value.begin(), value.end());
+		return parse(value.begin(), value.end(), range);
 	}
 	
 	operator json() const;
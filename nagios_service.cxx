@@ -8,17 +8,19 @@
 
 using namespace std;
 
-nagios_service::operator json() const
+json nagios_service::to_json(const nagios_service_state& state) const
 {
 	json j;
 	map<string, json>& map(j.map_value());
 	map["service_description"].string_value() = _description;
-	map["current_state"].number_value() = _cur_state;
-	map["state_type"].number_value() = _state_type;
+	map["current_state"].number_value() = state.current_state();
+	map["state_type"].number_value() = state.state_type();
 	if (_output.size())
 		map["plugin_output"].string_value() = _output;
 	if (_performance.size())
 		map["performance_data"] = json(_performance);
-	map["is_flapping"].number_value() = _flapping ? 1 : 0;
+	if (_raw_performance.size())
+		map["performance_data_raw"].string_value() = _raw_performance;
+	map["is_flapping"].number_value() = state.is_flapping() ? 1 : 0;
 	return j;
 }
\ No newline at end of file
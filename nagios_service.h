@@ -7,39 +7,58 @@
 #include "json.h"
 #include "nagios_perfdata.h"
 
+// Fields read by every pass over the services, kept apart from the strings.
+class nagios_service_state
+{
+private:
+	signed char _cur_state;
+	signed char _state_type;
+	bool _flapping;
+
+public:
+	nagios_service_state() : _cur_state(-1), _state_type(-1), _flapping(false) { }
+
+	inline signed char& current_state() { return _cur_state; }
+	inline int current_state() const { return _cur_state; }
+	
+	inline signed char& state_type() { return _state_type; }
+	inline int state_type() const { return _state_type; }
+	
+	inline bool& is_flapping() { return _flapping; }
+	inline bool is_flapping() const { return _flapping; }
+};
+
 class nagios_service
 {
 private:
 	std::string _description;
-	int _cur_state;
-	int _state_type;
 	std::string _output;
 	std::vector<nagios_perfdata> _performance;
-	bool _flapping;
+	std::string _raw_performance;
+	long long _last_change;
 
 public:
-	nagios_service() : _description(), _cur_state(-1), _state_type(-1), _output(), _performance(), _flapping(false) { }
-	explicit nagios_service(const std::string& service_description) : _description(service_description), _cur_state(-1), _state_type(-1), _output(), _performance(), _flapping(false) { }
+	nagios_service() : _description(), _output(), _performance(), _raw_performance(), _last_change(0) { }
+	explicit nagios_service(const std::string& service_description) : _description(service_description), _output(), _performance(), _raw_performance(), _last_change(0) { }
 
 	inline std::string& service_description() { return _description; }
 	inline const std::string& service_description() const { return _description; }
 	
-	inline int& current_state() { return _cur_state; }
-	inline int current_state() const { return _cur_state; }
-	
-	inline int& state_type() { return _state_type; }
-	inline int state_type() const { return _state_type; }
-	
 	inline std::string& plugin_output() { return _output; }
 	inline const std::string& plugin_output() const { return _output; }
 	
 	inline std::vector<nagios_perfdata>& performance_data() { return _performance; }
 	inline const std::vector<nagios_perfdata>& performance_data() const { return _performance; }
 	
-	inline bool& is_flapping() { return _flapping; }
-	inline bool is_flapping() const { return _flapping; }
+	// The perfdata as the plugin wrote it, kept only when malformed.
+	inline std::string& performance_data_raw() { return _raw_performance; }
+	inline const std::string& performance_data_raw() const { return _raw_performance; }
+	
+	// Unix time of the last change of state, only shown among problems.
+	inline long long& last_state_change() { return _last_change; }
+	inline long long last_state_change() const { return _last_change; }
 	
-	operator json() const;
+	json to_json(const nagios_service_state& state) const;
 };
 
 #endif
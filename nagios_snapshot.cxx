@@ -0,0 +1,1018 @@
+#include "globals.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "block_reader.h"
+#include "file_reader.h"
+#include "host_filter.h"
+#include "json.h"
+#include "nagios_host.h"
+#include "nagios_perfdata.h"
+#include "nagios_service.h"
+#include "nagios_snapshot.h"
+#include "openmetrics.h"
+#include "pipeline.h"
+#include "serializer.h"
+#include "strutil.h"
+
+using namespace std;
+
+namespace
+{
+	template<typename T>
+	void put(string& image, T value)
+	{
+		image.append(reinterpret_cast<const char*>(&value), sizeof(value));
+	}
+	void put(string& image, const string& value)
+	{
+		put(image, static_cast<uint32_t>(value.size()));
+		image += value;
+	}
+	void put(string& image, const nagios_range& range)
+	{
+		put(image, range.minimum());
+		put(image, range.maximum());
+		put(image, static_cast<uint8_t>(range.inside()));
+	}
+
+	// Reads an image front to back; every read checks the bounds first.
+	class image_reader
+	{
+	private:
+		const char* _position;
+		const char* _end;
+		bool _good;
+
+	public:
+		image_reader(const char* data, size_t size) : _position(data), _end(data + size), _good(true) { }
+
+		inline bool good() const { return _good; }
+		inline bool at_end() const { return _position == _end; }
+
+		template<typename T>
+		T get()
+		{
+			T value = T();
+			if (static_cast<size_t>(_end - _position) < sizeof(value))
+				_good = false;
+			else
+			{
+				memcpy(&value, _position, sizeof(value));
+				_position += sizeof(value);
+			}
+			return value;
+		}
+		string get_string()
+		{
+			uint32_t length = get<uint32_t>();
+			if (static_cast<size_t>(_end - _position) < length)
+			{
+				_good = false;
+				return string();
+			}
+			string value(_position, length);
+			_position += length;
+			return value;
+		}
+		nagios_range get_range()
+		{
+			double minimum = get<double>();
+			double maximum = get<double>();
+			return nagios_range(minimum, maximum, get<uint8_t>() != 0);
+		}
+		void skip(uint64_t length)
+		{
+			if (static_cast<uint64_t>(_end - _position) < length)
+				_good = false;
+			else
+				_position += length;
+		}
+	};
+}
+
+struct nagios_snapshot::status_record
+{
+	bool service;
+	string host_name;
+	string service_description;
+	string current_state;
+	string state_type;
+	string plugin_output;
+	string performance_data;
+	string is_flapping;
+	string last_state_change;
+	string active_checks_enabled;
+	string check_period;
+};
+
+namespace
+{
+	// Records, or hosts, in a batch handed from a stage to the next.
+	const size_t record_batch_size = 256;
+	const size_t host_batch_size = 16;
+}
+
+bool nagios_snapshot::pipelined()
+{
+	return thread::hardware_concurrency() > 1;
+}
+
+parse_errors& parse_errors::operator +=(const parse_errors& other)
+{
+	_state += other._state;
+	for (int i = parse_bad_syntax; i <= parse_bad_range; ++i)
+		_perfdata[i] += other._perfdata[i];
+	return *this;
+}
+parse_errors::operator json() const
+{
+	json j;
+	map<string, json>& map(j.map_value());
+	map["state"].number_value() = _state;
+	map["perfdata_syntax"].number_value() = _perfdata[parse_bad_syntax];
+	map["perfdata_number"].number_value() = _perfdata[parse_bad_number];
+	map["perfdata_range"].number_value() = _perfdata[parse_bad_range];
+	return j;
+}
+
+bool nagios_snapshot::state_field(const string& text, int& value)
+{
+	if (getinteger(text, value))
+		return true;
+	_errors.count_state();
+	return false;
+}
+void nagios_snapshot::fill_status(nagios_host& hst, const string& service_description, const status_record& record)
+{
+	nagios_host::service_map::size_type i = hst.service(service_description);
+	nagios_service_state state;
+	nagios_service& svc = hst.services()[i];
+	int value;
+	if (state_field(record.current_state, value))
+		state.current_state() = value;
+	if (state_field(record.state_type, value))
+		state.state_type() = value;
+	svc.plugin_output() = record.plugin_output;
+	parse_status status = nagios_perfdata::parse_all(svc.performance_data(), record.performance_data);
+	if (status != parse_ok)
+	{
+		svc.performance_data_raw() = record.performance_data;
+		_errors.count_perfdata(status);
+	}
+	state.is_flapping() = state_field(record.is_flapping, value) && value != 0;
+	// Optional: only a value that is there but not a number counts.
+	if (record.last_state_change.size() && !getinteger(record.last_state_change, svc.last_state_change()))
+		_errors.count_state();
+	_summary.replace(hst.states()[i], state);
+	hst.update(i, state);
+}
+void nagios_snapshot::fill_object(nagios_host& hst, map<string, string>& data)
+{
+	hst.alias() = data["alias"];
+	hst.display_name() = data["display_name"];
+	hst.icon_image() = data["icon_image"];
+}
+
+bool nagios_snapshot::visible(const host_filter& filter, const string& host_name) const
+{
+	if (filter.host_prefix().size() && !starts_with(host_name, filter.host_prefix()))
+		return false;
+	if (!filter.alias_prefix().size() && !filter.display_prefix().size())
+		return true;
+	host_map::size_type i = _hosts.find(host_name);
+	return i != host_map::npos && filter.visible(_hosts[i]);
+}
+
+// Hosts that are not actively checked have no meaningful state.
+bool nagios_snapshot::checked(const status_record& record)
+{
+	int active;
+	return state_field(record.active_checks_enabled, active) && active != 0 && record.check_period != "" && record.check_period != "none";
+}
+bool nagios_snapshot::read_records(block_reader& reader, const host_filter& filter, status_batch& batch)
+{
+	static const struct
+	{
+		const char* key;
+		string status_record::*field;
+	} fields[] = {
+		{ "host_name", &status_record::host_name },
+		{ "service_description", &status_record::service_description },
+		{ "current_state", &status_record::current_state },
+		{ "state_type", &status_record::state_type },
+		{ "plugin_output", &status_record::plugin_output },
+		{ "performance_data", &status_record::performance_data },
+		{ "is_flapping", &status_record::is_flapping },
+		{ "last_state_change", &status_record::last_state_change },
+		{ "active_checks_enabled", &status_record::active_checks_enabled },
+		{ "check_period", &status_record::check_period }
+	};
+	string object_type, k, v;
+	while (batch.size() < record_batch_size && reader.next_block(object_type))
+	{
+		bool service = object_type == "servicestatus";
+		if (!service && object_type != "hoststatus")
+		{
+			reader.skip_block();
+			continue;
+		}
+		batch.emplace_back();
+		status_record& record = batch.back();
+		record.service = service;
+		bool wanted = true;
+		while (reader.next_field(k, v))
+		{
+			// Blocks of hosts the filter hides are passed over unstored.
+			if (k == "host_name" && !starts_with(v, filter.host_prefix()))
+			{
+				reader.skip_block();
+				wanted = false;
+				break;
+			}
+			for (unsigned i(0); i < sizeof(fields) / sizeof(fields[0]); ++i)
+				if (k == fields[i].key)
+				{
+					(record.*fields[i].field).swap(v);
+					break;
+				}
+		}
+		if (!wanted || reader.truncated())
+			batch.pop_back();
+	}
+	return !batch.empty();
+}
+
+void nagios_snapshot::read_status(istream& file, const host_filter& filter)
+{
+	block_reader reader(file, '=');
+	pipeline_stage<status_batch> records([&](status_batch& batch) { return read_records(reader, filter, batch); }, pipelined());
+	status_batch batch;
+	while (records.next(batch))
+		for (status_batch::const_iterator it = batch.begin(); it != batch.end(); ++it)
+		{
+			if (!visible(filter, it->host_name))
+				continue;
+			if (it->service)
+				fill_status(host(it->host_name), it->service_description, *it);
+			else if (checked(*it))
+				fill_status(host(it->host_name), "Ping", *it);
+		}
+}
+void nagios_snapshot::read_objects(istream& file)
+{
+	block_reader reader(file, '\t');
+	map<string, string> object_data;
+	string header, k, v;
+	while (reader.next_block(header))
+	{
+		if (header.size() < 8 || header.compare(0, 7, "define ") != 0)
+			continue;
+		if (header.compare(7, string::npos, "host") != 0)
+		{
+			reader.skip_block();
+			continue;
+		}
+		while (reader.next_field(k, v))
+			object_data[k] = v;
+		if (!reader.truncated())
+			fill_object(host(object_data["host_name"]), object_data);
+		object_data.clear();
+	}
+}
+
+// objects.cache comes first, for the filter to know aliases and display
+// names when reading status.dat.
+void nagios_snapshot::load(const string& status_file, const string& objects_file, const host_filter& filter)
+{
+	vector<string> paths;
+	paths.push_back(objects_file);
+	paths.push_back(status_file);
+	file_reader reader(paths);
+	read_objects(reader.stream(0));
+	read_status(reader.stream(1), filter);
+	sort();
+}
+void nagios_snapshot::load(const vector<nagios_instance>& instances, const host_filter& filter)
+{
+	vector<nagios_instance>::size_type count = instances.size();
+	if (count == 1 && !instances.front().host_prefix().size())
+	{
+		load(instances.front().status_file(), instances.front().objects_file(), filter);
+		return;
+	}
+	vector<nagios_snapshot> snapshots(count);
+	vector<thread> threads;
+	threads.reserve(count);
+	for (vector<nagios_instance>::size_type i(0); i < count; ++i)
+	{
+		host_filter instance_filter;
+		if (filter.within(instances[i].host_prefix(), instance_filter))
+			threads.emplace_back([&snapshots, &instances, instance_filter, i]() { snapshots[i].load(instances[i].status_file(), instances[i].objects_file(), instance_filter); });
+	}
+	for (vector<thread>::iterator it = threads.begin(); it != threads.end(); ++it)
+		it->join();
+	for (vector<nagios_instance>::size_type i(0); i < count; ++i)
+		merge(move(snapshots[i]), instances[i].host_prefix());
+	sort();
+}
+// Host attributes and host checks are kept for every host, services only
+// for the host being read. It is handed over once a service of another host
+// comes, so a host whose services are not together in status.dat is
+// written once for each run of them. The hosts without services follow, in
+// name order.
+class nagios_snapshot::host_reader
+{
+private:
+	nagios_snapshot& _snapshot;
+	const host_filter& _filter;
+	pipeline_stage<status_batch>& _records;
+	status_batch _batch;
+	status_batch::size_type _next_record;
+	vector<bool> _written;
+	nagios_host _current;
+	bool _reading;
+	// Once the records are all read.
+	vector<host_map::size_type> _order;
+	host_map::size_type _next_host;
+	bool _done;
+
+	void hand_over(nagios_host&& hst, vector<nagios_host>& hosts)
+	{
+		hst.sort();
+		hosts.push_back(move(hst));
+	}
+	void read_record(const status_record& record, vector<nagios_host>& hosts)
+	{
+		if (!_snapshot.visible(_filter, record.host_name))
+			return;
+		if (!record.service)
+		{
+			if (_snapshot.checked(record))
+				_snapshot.fill_status(_reading && _current.host_name() == record.host_name ? _current : _snapshot.host(record.host_name), "Ping", record);
+			return;
+		}
+		if (!_reading || _current.host_name() != record.host_name)
+		{
+			if (_reading)
+				hand_over(move(_current), hosts);
+			host_map::size_type i = _snapshot._hosts.insert(record.host_name);
+			if (_written.size() <= i)
+				_written.resize(i + 1, false);
+			_written[i] = true;
+			_current = _snapshot._hosts[i];
+			_reading = true;
+		}
+		_snapshot.fill_status(_current, record.service_description, record);
+	}
+
+public:
+	host_reader(nagios_snapshot& snapshot, const host_filter& filter, pipeline_stage<status_batch>& records) : _snapshot(snapshot), _filter(filter), _records(records), _batch(), _next_record(0), _written(), _current(), _reading(false), _order(), _next_host(0), _done(false) { }
+
+	bool read(vector<nagios_host>& hosts)
+	{
+		while (hosts.size() < host_batch_size)
+			if (_next_record < _batch.size())
+				read_record(_batch[_next_record++], hosts);
+			else if (!_done)
+			{
+				_next_record = 0;
+				if (_records.next(_batch))
+					continue;
+				_done = true;
+				if (_reading)
+					hand_over(move(_current), hosts);
+				_reading = false;
+				_written.resize(_snapshot._hosts.size(), false);
+				_order = _snapshot._hosts.sort();
+			}
+			else if (_next_host < _order.size())
+			{
+				host_map::size_type i = _next_host++;
+				if (!_written[_order[i]])
+					hand_over(nagios_host(_snapshot._hosts[i]), hosts);
+			}
+			else
+				break;
+		return !hosts.empty();
+	}
+};
+
+void nagios_snapshot::stream(const string& status_file, const string& objects_file, const host_filter& filter, serializer& out)
+{
+	{
+		ifstream objects(objects_file);
+		read_objects(objects);
+	}
+	ifstream status(status_file);
+	block_reader reader(status, '=');
+	bool threaded = pipelined();
+	pipeline_stage<status_batch> records([&](status_batch& batch) { return read_records(reader, filter, batch); }, threaded);
+	host_reader filler(*this, filter, records);
+	pipeline_stage<vector<nagios_host> > hosts([&](vector<nagios_host>& batch) { return filler.read(batch); }, threaded);
+	out.begin_vector(0);
+	vector<nagios_host> batch;
+	while (hosts.next(batch))
+		for (vector<nagios_host>::iterator it = batch.begin(); it != batch.end(); ++it)
+			write_host(*it, filter, out);
+	out.end_vector();
+}
+void nagios_snapshot::write_host(nagios_host& hst, const host_filter& filter, serializer& out)
+{
+	hst.sort();
+	if (filter.matches(hst))
+		out.write(filter.apply(hst));
+}
+void nagios_snapshot::load_objects(const vector<nagios_instance>& instances)
+{
+	vector<nagios_instance>::const_iterator end = instances.end();
+	for (vector<nagios_instance>::const_iterator it = instances.begin(); it != end; ++it)
+	{
+		nagios_snapshot instance;
+		ifstream ifs(it->objects_file());
+		instance.read_objects(ifs);
+		merge(move(instance), it->host_prefix());
+	}
+	sort();
+}
+void nagios_snapshot::merge(nagios_snapshot&& other, const string& host_prefix)
+{
+	host_map::iterator end = other._hosts.end();
+	for (host_map::iterator it = other._hosts.begin(); it != end; ++it)
+	{
+		string host_name(host_prefix + it->host_name());
+		host_map::size_type count = _hosts.size();
+		nagios_host& hst = host(host_name);
+		if (_hosts.size() != count)
+		{
+			_summary += it->summary();
+			hst = move(*it);
+			hst.host_name() = host_name;
+			continue;
+		}
+		if (!hst.alias().size())
+			hst.alias() = it->alias();
+		if (!hst.display_name().size())
+			hst.display_name() = it->display_name();
+		if (!hst.icon_image().size())
+			hst.icon_image() = it->icon_image();
+		nagios_host::service_map& services = it->services();
+		nagios_host::service_map::size_type size = services.size();
+		for (nagios_host::service_map::size_type i(0); i < size; ++i)
+		{
+			nagios_host::service_map::size_type known = hst.services().size();
+			nagios_host::service_map::size_type j = hst.service(services[i].service_description());
+			if (j == known)
+			{
+				hst.services()[j] = move(services[i]);
+				_summary.replace(hst.states()[j], it->states()[i]);
+				hst.update(j, it->states()[i]);
+			}
+		}
+	}
+	_errors += other._errors;
+	other._hosts = host_map();
+	other._summary = nagios_summary();
+	other._errors = parse_errors();
+}
+void nagios_snapshot::sort()
+{
+	_hosts.sort();
+	host_map::iterator end = _hosts.end();
+	for (host_map::iterator it = _hosts.begin(); it != end; ++it)
+		it->sort();
+}
+
+// Each host is its name, alias, display name and icon, the size of its
+// services in bytes, so that hidden hosts can be skipped, then its services.
+void nagios_snapshot::write_image(string& image) const
+{
+	host_map::const_iterator end = _hosts.end();
+	for (host_map::const_iterator it = _hosts.begin(); it != end; ++it)
+	{
+		put(image, it->host_name());
+		put(image, it->alias());
+		put(image, it->display_name());
+		put(image, it->icon_image());
+		string::size_type length = image.size();
+		put(image, static_cast<uint64_t>(0));
+		const nagios_host::service_map& services = it->services();
+		nagios_host::service_map::size_type size = services.size();
+		put(image, static_cast<uint32_t>(size));
+		for (nagios_host::service_map::size_type i(0); i < size; ++i)
+		{
+			const nagios_service_state& state = it->states()[i];
+			put(image, services[i].service_description());
+			put(image, services[i].plugin_output());
+			put(image, static_cast<int8_t>(state.current_state()));
+			put(image, static_cast<int8_t>(state.state_type()));
+			put(image, static_cast<uint8_t>(state.is_flapping()));
+			const vector<nagios_perfdata>& performance = services[i].performance_data();
+			put(image, static_cast<uint32_t>(performance.size()));
+			vector<nagios_perfdata>::const_iterator pend = performance.end();
+			for (vector<nagios_perfdata>::const_iterator perfdata = performance.begin(); perfdata != pend; ++perfdata)
+			{
+				put(image, perfdata->label());
+				put(image, perfdata->value());
+				put(image, perfdata->uom());
+				put(image, perfdata->warning());
+				put(image, perfdata->critical());
+				put(image, perfdata->minimum());
+				put(image, perfdata->maximum());
+			}
+			put(image, services[i].performance_data_raw());
+			put(image, static_cast<int64_t>(services[i].last_state_change()));
+		}
+		uint64_t services_length = image.size() - length - sizeof(uint64_t);
+		memcpy(&image[length], &services_length, sizeof(services_length));
+	}
+}
+bool nagios_snapshot::read_image(const char* data, size_t size, const host_filter& filter)
+{
+	image_reader reader(data, size);
+	bool in_order = true;
+	while (reader.good() && !reader.at_end())
+	{
+		nagios_host attributes(reader.get_string());
+		attributes.alias() = reader.get_string();
+		attributes.display_name() = reader.get_string();
+		attributes.icon_image() = reader.get_string();
+		uint64_t services_length = reader.get<uint64_t>();
+		if (!filter.visible(attributes))
+		{
+			reader.skip(services_length);
+			continue;
+		}
+		nagios_host& hst = host(attributes.host_name());
+		hst.alias().swap(attributes.alias());
+		hst.display_name().swap(attributes.display_name());
+		hst.icon_image().swap(attributes.icon_image());
+		uint32_t count = reader.get<uint32_t>();
+		for (uint32_t i(0); i < count && reader.good(); ++i)
+		{
+			nagios_host::service_map::size_type j = hst.service(reader.get_string());
+			nagios_service& svc = hst.services()[j];
+			nagios_service_state state;
+			svc.plugin_output() = reader.get_string();
+			state.current_state() = reader.get<int8_t>();
+			state.state_type() = reader.get<int8_t>();
+			state.is_flapping() = reader.get<uint8_t>() != 0;
+			uint32_t perfdata_count = reader.get<uint32_t>();
+			for (uint32_t k(0); k < perfdata_count && reader.good(); ++k)
+			{
+				string label(reader.get_string());
+				double value = reader.get<double>();
+				string uom(reader.get_string());
+				nagios_range warning(reader.get_range());
+				nagios_range critical(reader.get_range());
+				double minimum = reader.get<double>();
+				double maximum = reader.get<double>();
+				svc.performance_data().emplace_back(label, value, uom, warning, critical, minimum, maximum);
+			}
+			svc.performance_data_raw() = reader.get_string();
+			svc.last_state_change() = reader.get<int64_t>();
+			_summary.replace(hst.states()[j], state);
+			hst.update(j, state);
+		}
+		in_order = in_order && hst.services().sorted();
+	}
+	// The writer walks a sorted snapshot, so hosts and services come in
+	// order and need no sort(); an image where they do not is refused.
+	return reader.good() && in_order && _hosts.sorted();
+}
+
+nagios_snapshot::host_map::size_type nagios_snapshot::first(const host_filter& filter) const
+{
+	return filter.host_prefix().size() ? _hosts.lower_bound(filter.host_prefix()) : 0;
+}
+bool nagios_snapshot::past(const host_filter& filter, host_map::size_type i) const
+{
+	return i >= _hosts.size() || (filter.host_prefix().size() && !starts_with(_hosts[i].host_name(), filter.host_prefix()));
+}
+
+json nagios_snapshot::generate_json(const host_filter& filter) const
+{
+	json j;
+	vector<json>& vec = j.vector_value();
+	for (host_map::size_type i = first(filter); !past(filter, i); ++i)
+		if (filter.matches(_hosts[i]))
+			vec.emplace_back(filter.apply(_hosts[i]));
+	return j;
+}
+// Encodings that do not need the count up front get each chunk as soon as
+// it and those before it are ready, flushed, rather than all at the end.
+void nagios_snapshot::write_json(const host_filter& filter, serializer& out, unsigned threads) const
+{
+	static const host_map::size_type chunk_size = 256;
+	host_map::size_type begin = first(filter), end = begin;
+	while (!past(filter, end))
+		++end;
+	host_map::size_type chunks = (end - begin + chunk_size - 1) / chunk_size;
+	vector<string> buffers(chunks);
+	vector<serializer::size_type> counts(chunks, 0);
+	vector<bool> done(chunks, false);
+	host_map::size_type written = 0;
+	bool streaming = !out.sized();
+	mutex lock;
+	condition_variable ready;
+	atomic<host_map::size_type> next(0);
+	// On the calling thread only; chunks that are done are no longer touched
+	// by the others, so they are written without the lock.
+	auto write_ready = [&](unique_lock<mutex>& guard)
+	{
+		host_map::size_type from = written;
+		while (written < chunks && done[written])
+			++written;
+		guard.unlock();
+		for (host_map::size_type c = from; c < written; ++c)
+		{
+			out.raw_values(buffers[c], counts[c]);
+			string().swap(buffers[c]);
+		}
+		out.flush();
+		guard.lock();
+	};
+	auto work = [&](bool writer)
+	{
+		for (host_map::size_type c; (c = next++) < chunks; )
+		{
+			ostringstream os;
+			unique_ptr<serializer> encoder(out.spawn(os));
+			encoder->begin_sequence();
+			host_map::size_type stop = begin + (c + 1) * chunk_size < end ? begin + (c + 1) * chunk_size : end;
+			for (host_map::size_type i = begin + c * chunk_size; i < stop; ++i)
+				if (filter.matches(_hosts[i]))
+				{
+					encoder->write(filter.apply(_hosts[i]));
+					++counts[c];
+				}
+			encoder->end_sequence();
+			unique_lock<mutex> guard(lock);
+			buffers[c] = os.str();
+			done[c] = true;
+			if (writer)
+				write_ready(guard);
+			else if (streaming)
+				ready.notify_one();
+		}
+	};
+	if (streaming)
+		out.begin_vector(0);
+	// Helpers of all renders together are at most threads - 1, so that
+	// concurrent requests do not each start as many. Chunks that no helper
+	// takes, for want of one or because one cannot be created, are encoded
+	// on the calling thread.
+	static atomic<unsigned> helpers(0);
+	vector<thread> pool;
+	pool.reserve(threads > 1 && chunks > 1 ? min<host_map::size_type>(threads, chunks) - 1 : 0);
+	for (unsigned t(1); t < threads && t < chunks; ++t)
+	{
+		if (helpers++ >= threads - 1)
+		{
+			--helpers;
+			break;
+		}
+		try
+		{
+			pool.emplace_back(work, false);
+		}
+		catch (const system_error&)
+		{
+			--helpers;
+			break;
+		}
+	}
+	auto join = [&]()
+	{
+		for (vector<thread>::iterator it = pool.begin(); it != pool.end(); ++it)
+			it->join();
+		helpers -= pool.size();
+	};
+	try
+	{
+		work(streaming);
+		if (streaming)
+		{
+			unique_lock<mutex> guard(lock);
+			while (written < chunks)
+			{
+				ready.wait(guard, [&]() { return done[written]; });
+				write_ready(guard);
+			}
+		}
+	}
+	catch (...)
+	{
+		next = chunks;
+		join();
+		throw;
+	}
+	join();
+	if (!streaming)
+	{
+		serializer::size_type total = 0;
+		for (host_map::size_type c(0); c < chunks; ++c)
+			total += counts[c];
+		out.begin_vector(total);
+		for (host_map::size_type c(0); c < chunks; ++c)
+		{
+			out.raw_values(buffers[c], counts[c]);
+			string().swap(buffers[c]);
+		}
+	}
+	out.end_vector();
+}
+namespace
+{
+	// Distinct strings, numbered in order of appearance.
+	class dictionary
+	{
+	private:
+		map<string, serializer::size_type> _index;
+		vector<const string*> _values;
+
+	public:
+		dictionary() : _index(), _values() { }
+
+		serializer::size_type add(const string& value)
+		{
+			map<string, serializer::size_type>::iterator it = _index.find(value);
+			if (it == _index.end())
+			{
+				it = _index.insert(make_pair(value, _values.size())).first;
+				_values.push_back(&it->first);
+			}
+			return it->second;
+		}
+
+		void write(serializer& out) const
+		{
+			out.begin_vector(_values.size());
+			for (vector<const string*>::const_iterator it = _values.begin(); it != _values.end(); ++it)
+				out.string_value(**it);
+			out.end_vector();
+		}
+	};
+
+	template<typename Row, typename Write>
+	void write_column(serializer& out, const char* name, const vector<Row>& rows, Write write)
+	{
+		out.key(name);
+		out.begin_vector(rows.size());
+		for (typename vector<Row>::const_iterator it = rows.begin(); it != rows.end(); ++it)
+			write(*it);
+		out.end_vector();
+	}
+
+	inline void write_finite(serializer& out, double value)
+	{
+		if (std::isfinite(value))
+			out.number_value(value);
+		else
+			out.null_value();
+	}
+}
+
+void nagios_snapshot::write_columns(const host_filter& filter, serializer& out) const
+{
+	struct service_row
+	{
+		serializer::size_type host;
+		const nagios_service* service;
+		const nagios_service_state* state;
+		serializer::size_type description;
+	};
+	struct perfdata_row
+	{
+		serializer::size_type service;
+		const nagios_perfdata* perfdata;
+		serializer::size_type label;
+		serializer::size_type uom;
+	};
+	// Rows are gathered first, as sized encodings need the array lengths.
+	vector<const nagios_host*> hosts;
+	vector<service_row> services;
+	vector<perfdata_row> perfdata;
+	dictionary descriptions, labels, uoms;
+	for (host_map::size_type i = first(filter); !past(filter, i); ++i)
+	{
+		const nagios_host& host = _hosts[i];
+		if (!filter.matches(host))
+			continue;
+		const nagios_host::service_map& host_services = host.services();
+		nagios_host::service_map::size_type size = host_services.size();
+		for (nagios_host::service_map::size_type j(0); j < size; ++j)
+		{
+			const nagios_service& service = host_services[j];
+			vector<nagios_perfdata>::const_iterator end = service.performance_data().end();
+			for (vector<nagios_perfdata>::const_iterator it = service.performance_data().begin(); it != end; ++it)
+			{
+				perfdata_row row = { services.size(), &*it, labels.add(it->label()), uoms.add(it->uom()) };
+				perfdata.push_back(row);
+			}
+			service_row row = { hosts.size(), &service, &host.states()[j], descriptions.add(service.service_description()) };
+			services.push_back(row);
+		}
+		hosts.push_back(&host);
+	}
+	out.begin_map(6);
+	out.key("hosts");
+	out.begin_map(4);
+	write_column(out, "host_name", hosts, [&](const nagios_host* host) { out.string_value(filter.host_name(*host)); });
+	write_column(out, "alias", hosts, [&](const nagios_host* host) { out.string_value(filter.alias(*host)); });
+	write_column(out, "display_name", hosts, [&](const nagios_host* host) { out.string_value(filter.display_name(*host)); });
+	write_column(out, "icon_image", hosts, [&](const nagios_host* host) { out.string_value(host->icon_image()); });
+	out.end_map();
+	out.key("services");
+	out.begin_map(7);
+	write_column(out, "host", services, [&](const service_row& row) { out.number_value(row.host); });
+	write_column(out, "service_description", services, [&](const service_row& row) { out.number_value(row.description); });
+	write_column(out, "current_state", services, [&](const service_row& row) { out.number_value(row.state->current_state()); });
+	write_column(out, "state_type", services, [&](const service_row& row) { out.number_value(row.state->state_type()); });
+	write_column(out, "plugin_output", services, [&](const service_row& row) { out.string_value(row.service->plugin_output()); });
+	write_column(out, "is_flapping", services, [&](const service_row& row) { out.number_value(row.state->is_flapping() ? 1 : 0); });
+	write_column(out, "performance_data_raw", services, [&](const service_row& row) { out.string_value(row.service->performance_data_raw()); });
+	out.end_map();
+	out.key("perfdata");
+	out.begin_map(12);
+	write_column(out, "service", perfdata, [&](const perfdata_row& row) { out.number_value(row.service); });
+	write_column(out, "label", perfdata, [&](const perfdata_row& row) { out.number_value(row.label); });
+	write_column(out, "value", perfdata, [&](const perfdata_row& row) { write_finite(out, row.perfdata->value()); });
+	write_column(out, "uom", perfdata, [&](const perfdata_row& row) { out.number_value(row.uom); });
+	write_column(out, "warning_minimum", perfdata, [&](const perfdata_row& row) { write_finite(out, row.perfdata->warning().minimum()); });
+	write_column(out, "warning_maximum", perfdata, [&](const perfdata_row& row) { write_finite(out, row.perfdata->warning().maximum()); });
+	write_column(out, "warning_inside", perfdata, [&](const perfdata_row& row) { out.number_value(row.perfdata->warning().inside() ? 1 : 0); });
+	write_column(out, "critical_minimum", perfdata, [&](const perfdata_row& row) { write_finite(out, row.perfdata->critical().minimum()); });
+	write_column(out, "critical_maximum", perfdata, [&](const perfdata_row& row) { write_finite(out, row.perfdata->critical().maximum()); });
+	write_column(out, "critical_inside", perfdata, [&](const perfdata_row& row) { out.number_value(row.perfdata->critical().inside() ? 1 : 0); });
+	write_column(out, "minimum", perfdata, [&](const perfdata_row& row) { write_finite(out, row.perfdata->minimum()); });
+	write_column(out, "maximum", perfdata, [&](const perfdata_row& row) { write_finite(out, row.perfdata->maximum()); });
+	out.end_map();
+	out.key("descriptions");
+	descriptions.write(out);
+	out.key("labels");
+	labels.write(out);
+	out.key("uoms");
+	uoms.write(out);
+	out.end_map();
+}
+// The cursor is the name of the last host of the previous page without the
+// user's host prefix, which is not to be shown, and put back when decoding.
+json nagios_snapshot::generate_page(const host_filter& filter, const string& after, host_map::size_type limit) const
+{
+	json j;
+	map<string, json>& map(j.map_value());
+	vector<json>& vec = map["hosts"].vector_value();
+	host_map::size_type i = first(filter);
+	string::size_type prefix = filter.host_prefix().size();
+	string last;
+	if (after.size() && base64url_decode(after, last))
+	{
+		host_map::size_type next = _hosts.upper_bound(filter.host_prefix() + last);
+		if (next > i)
+			i = next;
+	}
+	for (; !past(filter, i); ++i)
+		if (filter.matches(_hosts[i]))
+		{
+			if (vec.size() == limit)
+			{
+				map["next"].string_value() = base64url_encode(last);
+				break;
+			}
+			vec.emplace_back(filter.apply(_hosts[i]));
+			last = _hosts[i].host_name().substr(prefix);
+		}
+	return j;
+}
+
+void nagios_snapshot::write_metrics(const host_filter& filter, ostream& os) const
+{
+	openmetrics_writer writer(os);
+	for (host_map::size_type i = first(filter); !past(filter, i); ++i)
+		if (filter.matches(_hosts[i]))
+			writer.add(filter.host_name(_hosts[i]), _hosts[i]);
+	writer.finish();
+}
+
+json nagios_snapshot::generate_summary(const host_filter& filter, bool per_host) const
+{
+	json j;
+	map<string, json>& map(j.map_value());
+	if (filter.empty() && !per_host)
+	{
+		map["total"] = json(_summary);
+		return j;
+	}
+	nagios_summary total;
+	vector<json>* vec = per_host ? &map["hosts"].vector_value() : nullptr;
+	for (host_map::size_type i = first(filter); !past(filter, i); ++i)
+		if (filter.matches(_hosts[i]))
+		{
+			total += _hosts[i].summary();
+			if (vec)
+			{
+				json h(_hosts[i].summary());
+				h.map_value()["host_name"].string_value() = filter.host_name(_hosts[i]);
+				vec->push_back(move(h));
+			}
+		}
+	map["total"] = json(total);
+	return j;
+}
+namespace
+{
+	struct problem
+	{
+		uint64_t key;
+		nagios_snapshot::host_map::size_type host;
+		nagios_host::service_map::size_type service;
+	};
+
+	// What orders problems, packed so that a greater key is worse: a hard
+	// state, then the severity, then the time of the last state change.
+	uint64_t problem_key(const nagios_service_state& state, long long last_state_change)
+	{
+		static const uint64_t severity[] = { 0, 1, 3, 2 }; // OK, WARNING, CRITICAL, UNKNOWN
+		uint64_t time = last_state_change > 0 ? static_cast<uint64_t>(last_state_change) & ((UINT64_C(1) << 61) - 1) : 0;
+		return (static_cast<uint64_t>(state.state_type() == 1) << 63) | (severity[state.current_state()] << 61) | time;
+	}
+	// Ties go to the first service in host, then service order.
+	bool worse(const problem& a, const problem& b)
+	{
+		if (a.key != b.key)
+			return a.key > b.key;
+		return a.host != b.host ? a.host < b.host : a.service < b.service;
+	}
+}
+
+// The heap keeps the limit worst problems seen so far, the least bad of
+// them on top, to be replaced by the next that is worse. Hosts whose
+// summary counts no problem are passed over without looking at their
+// services.
+json nagios_snapshot::generate_problems(const host_filter& filter, size_t limit) const
+{
+	vector<problem> heap;
+	heap.reserve(min<size_t>(limit, _summary.warning() + _summary.critical() + _summary.unknown()));
+	size_t total = 0;
+	for (host_map::size_type i = first(filter); !past(filter, i); ++i)
+	{
+		const nagios_host& host = _hosts[i];
+		const nagios_summary& summary = host.summary();
+		if (summary.services() == summary.ok() || !filter.matches(host))
+			continue;
+		nagios_host::service_map::size_type size = host.services().size();
+		for (nagios_host::service_map::size_type j(0); j < size; ++j)
+		{
+			const nagios_service_state& state = host.states()[j];
+			if (state.current_state() < 1 || state.current_state() > 3)
+				continue;
+			++total;
+			problem p = { problem_key(state, host.services()[j].last_state_change()), i, j };
+			if (heap.size() < limit)
+			{
+				heap.push_back(p);
+				push_heap(heap.begin(), heap.end(), worse);
+			}
+			else if (limit && worse(p, heap.front()))
+			{
+				pop_heap(heap.begin(), heap.end(), worse);
+				heap.back() = p;
+				push_heap(heap.begin(), heap.end(), worse);
+			}
+		}
+	}
+	sort_heap(heap.begin(), heap.end(), worse);
+	json j;
+	map<string, json>& map(j.map_value());
+	vector<json>& vec = map["problems"].vector_value();
+	vec.reserve(heap.size());
+	for (vector<problem>::const_iterator it = heap.begin(); it != heap.end(); ++it)
+	{
+		const nagios_host& host = _hosts[it->host];
+		const nagios_service& service = host.services()[it->service];
+		json p(service.to_json(host.states()[it->service]));
+		p.map_value()["host_name"].string_value() = filter.host_name(host);
+		p.map_value()["last_state_change"].number_value() = service.last_state_change();
+		vec.push_back(move(p));
+	}
+	map["total"].number_value() = total;
+	return j;
+}
\ No newline at end of file
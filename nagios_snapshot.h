@@ -0,0 +1,173 @@
+#ifndef __NAGIOS_SNAPSHOT_H
+#define __NAGIOS_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "flat_map.h"
+#include "host_filter.h"
+#include "json.h"
+#include "lexer.h"
+#include "nagios_host.h"
+#include "nagios_summary.h"
+
+class block_reader;
+class serializer;
+
+// One Nagios poller: its files, and a prefix given to its host names.
+class nagios_instance
+{
+private:
+	std::string _status_file;
+	std::string _objects_file;
+	std::string _host_prefix;
+
+public:
+	nagios_instance(const std::string& status_file, const std::string& objects_file, const std::string& host_prefix) : _status_file(status_file), _objects_file(objects_file), _host_prefix(host_prefix) { }
+
+	inline const std::string& status_file() const { return _status_file; }
+	inline const std::string& objects_file() const { return _objects_file; }
+	inline const std::string& host_prefix() const { return _host_prefix; }
+};
+
+// Malformed values met in status.dat, by kind. A state field that is not a
+// number is left unset, and perfdata that does not parse is kept as text.
+class parse_errors
+{
+private:
+	std::uint64_t _state;
+	std::uint64_t _perfdata[parse_bad_range + 1]; // by parse_status
+
+public:
+	parse_errors() : _state(0), _perfdata() { }
+
+	inline std::uint64_t state() const { return _state; }
+	inline std::uint64_t perfdata(parse_status status) const { return _perfdata[status]; }
+
+	inline void count_state() { ++_state; }
+	inline void count_perfdata(parse_status status) { ++_perfdata[status]; }
+
+	parse_errors& operator +=(const parse_errors& other);
+
+	operator json() const;
+};
+
+// Hosts and services as read from status.dat and objects.cache.
+class nagios_snapshot
+{
+public:
+	typedef flat_map<nagios_host, &nagios_host::host_name> host_map;
+
+private:
+	host_map _hosts;
+	nagios_summary _summary;
+	parse_errors _errors;
+
+	// Hosts sharing the filter's host prefix are contiguous once sorted.
+	host_map::size_type first(const host_filter& filter) const;
+	bool past(const host_filter& filter, host_map::size_type i) const;
+
+	inline nagios_host& host(const std::string& host_name) { return _hosts[_hosts.insert(host_name)]; }
+
+	// Whether filter shows host_name, judging aliases and display names from
+	// the objects already read.
+	bool visible(const host_filter& filter, const std::string& host_name) const;
+
+	// The fields of a hoststatus or servicestatus block that are used.
+	struct status_record;
+	typedef std::vector<status_record> status_batch;
+	class host_reader;
+
+	// Whether the stages of reading status.dat run on threads of their own.
+	static bool pipelined();
+	// Reads a state field, counting it if it is not a number.
+	bool state_field(const std::string& text, int& value);
+	bool checked(const status_record& record);
+	// Fills batch with the next status blocks of hosts with the filter's
+	// host prefix, aliases and display names being left to check. Returns
+	// false at the end of the file.
+	static bool read_records(block_reader& reader, const host_filter& filter, status_batch& batch);
+	void fill_status(nagios_host& hst, const std::string& service_description, const status_record& record);
+	static void fill_object(nagios_host& hst, std::map<std::string, std::string>& data);
+	static void write_host(nagios_host& hst, const host_filter& filter, serializer& out);
+
+public:
+	nagios_snapshot() : _hosts(), _summary(), _errors() { }
+
+	inline host_map& hosts() { return _hosts; }
+	inline const host_map& hosts() const { return _hosts; }
+	inline const nagios_summary& summary() const { return _summary; }
+	inline const parse_errors& errors() const { return _errors; }
+
+	// Skips the blocks of hosts the filter hides; read_objects() must have
+	// been called first for alias and display name prefixes to apply. With
+	// more than one core, blocks are tokenized on a thread of their own
+	// while the caller parses their values.
+	void read_status(std::istream& file, const host_filter& filter = host_filter());
+	void read_objects(std::istream& file);
+	// Reads both files and sorts hosts and services for output. Services of
+	// hosts the filter hides are left out.
+	void load(const std::string& status_file, const std::string& objects_file, const host_filter& filter = host_filter());
+	// Reads each instance on its own thread, then merges them in order.
+	void load(const std::vector<nagios_instance>& instances, const host_filter& filter = host_filter());
+	// Writes the vector of hosts the filter shows while reading status.dat,
+	// each host as soon as its services have been read, instead of holding
+	// them all: hosts come in status.dat order, which Nagios writes sorted
+	// and grouped, then the hosts without services. Only for encodings
+	// that do not need the size of the vector up front. With more than one
+	// core, tokenizing, filling hosts, and writing them run as a pipeline of
+	// three threads, a few batches apart at most.
+	void stream(const std::string& status_file, const std::string& objects_file, const host_filter& filter, serializer& out);
+	// Reads only objects.cache of each instance: host names and attributes.
+	void load_objects(const std::vector<nagios_instance>& instances);
+	// Adds the hosts of other, named host_prefix + host_name. A host known
+	// to both keeps the attributes it already has and gains the services it
+	// lacks; a service known to both keeps its current status.
+	void merge(nagios_snapshot&& other, const std::string& host_prefix);
+	void sort();
+
+	// Flat encoding of the hosts, with offsets and lengths instead of
+	// pointers, so that it can be mapped at any address.
+	void write_image(std::string& image) const;
+	// Adds the hosts of an image that the filter shows. Returns false if the
+	// image is truncated or malformed.
+	bool read_image(const char* data, std::size_t size, const host_filter& filter);
+
+	json generate_json(const host_filter& filter) const;
+	// Writes what generate_json() gives, encoded on up to threads threads,
+	// counting those that concurrent calls started: they take runs of hosts
+	// in turn, each encoded into a buffer of its own, and the buffers are
+	// spliced in order once all are done, or as soon as they are ready for
+	// encodings that need no size up front.
+	void write_json(const host_filter& filter, serializer& out, unsigned threads) const;
+	// The hosts the filter shows as parallel arrays, a field per array:
+	// {"hosts": {...}, "services": {...}, "perfdata": {...}, "descriptions",
+	// "labels", "uoms"}. Services refer to their host, and perfdata to their
+	// service, by index; descriptions, labels and units are indices into the
+	// arrays of their distinct values. Fields the row layout leaves out are
+	// empty strings, or null for numbers.
+	void write_columns(const host_filter& filter, serializer& out) const;
+	// At most limit hosts following the one named in the after cursor, as
+	// {"hosts": [...], "next": cursor}; next is left out on the last page.
+	json generate_page(const host_filter& filter, const std::string& after, host_map::size_type limit) const;
+	// Service counts over the hosts the filter shows, and for each of these
+	// hosts if per_host is set.
+	json generate_summary(const host_filter& filter, bool per_host) const;
+	// The limit worst services the filter shows that are not OK: hard
+	// states first, then CRITICAL, UNKNOWN and WARNING, then the most
+	// recent state change. As {"problems": [...], "total": n}, each
+	// service with its host_name and last_state_change, total counting all
+	// of them. Selected in a heap of limit entries, without sorting them
+	// all.
+	json generate_problems(const host_filter& filter, std::size_t limit) const;
+	// Service states and perfdata of the hosts the filter shows, as
+	// OpenMetrics text.
+	void write_metrics(const host_filter& filter, std::ostream& os) const;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#include "globals.h"
+
+#include <map>
+#include <string>
+
+#include "json.h"
+#include "nagios_service.h"
+#include "nagios_summary.h"
+
+using namespace std;
+
+// A service whose status was never read (current_state -1) is not counted.
+void nagios_summary::count(const nagios_service_state& state, int delta)
+{
+	int current_state = state.current_state();
+	if (current_state < 0)
+		return;
+	_services += delta;
+	if (current_state < 4)
+		_states[current_state] += delta;
+	if (state.state_type() == 1)
+		_hard += delta;
+	else if (state.state_type() == 0)
+		_soft += delta;
+	if (state.is_flapping())
+		_flapping += delta;
+}
+
+nagios_summary& nagios_summary::operator +=(const nagios_summary& other)
+{
+	_services += other._services;
+	for (int i = 0; i < 4; ++i)
+		_states[i] += other._states[i];
+	_hard += other._hard;
+	_soft += other._soft;
+	_flapping += other._flapping;
+	return *this;
+}
+nagios_summary& nagios_summary::operator -=(const nagios_summary& other)
+{
+	_services -= other._services;
+	for (int i = 0; i < 4; ++i)
+		_states[i] -= other._states[i];
+	_hard -= other._hard;
+	_soft -= other._soft;
+	_flapping -= other._flapping;
+	return *this;
+}
+
+nagios_summary::operator json() const
+{
+	json j;
+	map<string, json>& map(j.map_value());
+	map["services"].number_value() = _services;
+	map["ok"].number_value() = _states[0];
+	map["warning"].number_value() = _states[1];
+	map["critical"].number_value() = _states[2];
+	map["unknown"].number_value() = _states[3];
+	map["hard"].number_value() = _hard;
+	map["soft"].number_value() = _soft;
+	map["flapping"].number_value() = _flapping;
+	return j;
+}
\ No newline at end of file
@@ -0,0 +1,46 @@
+#ifndef __NAGIOS_SUMMARY_H
+#define __NAGIOS_SUMMARY_H
+
+#include "json.h"
+#include "nagios_service.h"
+
+// Service counts by state, state type and flapping, kept up to date as
+// service states are replaced rather than recounted.
+class nagios_summary
+{
+private:
+	unsigned _services;
+	unsigned _states[4]; // OK, WARNING, CRITICAL, UNKNOWN
+	unsigned _hard;
+	unsigned _soft;
+	unsigned _flapping;
+
+	void count(const nagios_service_state& state, int delta);
+
+public:
+	nagios_summary() : _services(0), _states(), _hard(0), _soft(0), _flapping(0) { }
+
+	inline unsigned services() const { return _services; }
+	inline unsigned ok() const { return _states[0]; }
+	inline unsigned warning() const { return _states[1]; }
+	inline unsigned critical() const { return _states[2]; }
+	inline unsigned unknown() const { return _states[3]; }
+	inline unsigned hard() const { return _hard; }
+	inline unsigned soft() const { return _soft; }
+	inline unsigned flapping() const { return _flapping; }
+
+	inline void add(const nagios_service_state& state) { count(state, 1); }
+	inline void remove(const nagios_service_state& state) { count(state, -1); }
+	inline void replace(const nagios_service_state& before, const nagios_service_state& after)
+	{
+		count(before, -1);
+		count(after, 1);
+	}
+
+	nagios_summary& operator +=(const nagios_summary& other);
+	nagios_summary& operator -=(const nagios_summary& other);
+
+	operator json() const;
+};
+
+#endif
@@ -0,0 +1,140 @@
+#include "globals.h"
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "nagios_host.h"
+#include "nagios_perfdata.h"
+#include "nagios_range.h"
+#include "nagios_service.h"
+#include "openmetrics.h"
+
+using namespace std;
+
+namespace
+{
+	struct family_description
+	{
+		const char* name;
+		const char* help;
+	};
+
+	const family_description families[] = {
+		{ "nagios_service_state", "Current state of the service: 0 OK, 1 WARNING, 2 CRITICAL, 3 UNKNOWN." },
+		{ "nagios_perfdata_value", "Value of a performance data metric, in its unit of measure." },
+		{ "nagios_perfdata_warning_minimum", "Lower bound of the warning range." },
+		{ "nagios_perfdata_warning_maximum", "Upper bound of the warning range." },
+		{ "nagios_perfdata_critical_minimum", "Lower bound of the critical range." },
+		{ "nagios_perfdata_critical_maximum", "Upper bound of the critical range." },
+		{ "nagios_perfdata_minimum", "Minimum value the metric can take." },
+		{ "nagios_perfdata_maximum", "Maximum value the metric can take." }
+	};
+
+	void append_label(string& labels, const char* name, const string& value)
+	{
+		if (labels.size())
+			labels.push_back(',');
+		labels += name;
+		labels += "=\"";
+		string::size_type from = 0, special;
+		while ((special = value.find_first_of("\\\"\n", from)) != string::npos)
+		{
+			labels.append(value, from, special - from);
+			labels.push_back('\\');
+			labels.push_back(value[special] == '\n' ? 'n' : value[special]);
+			from = special + 1;
+		}
+		labels.append(value, from, string::npos);
+		labels.push_back('"');
+	}
+
+	void append_number(string& s, double value)
+	{
+		if (std::isnan(value))
+		{
+			s += "NaN";
+			return;
+		}
+		char buffer[32];
+		long long integer(value);
+		if (integer != value || integer == LLONG_MIN)
+		{
+			s.append(buffer, snprintf(buffer, sizeof(buffer), "%.15g", value));
+			return;
+		}
+		// Most values are integers, which are spelt out by hand.
+		unsigned long long magnitude = integer < 0 ? -static_cast<unsigned long long>(integer) : integer;
+		char* p = buffer + sizeof(buffer);
+		do
+			*--p = '0' + magnitude % 10;
+		while (magnitude /= 10);
+		if (integer < 0)
+			*--p = '-';
+		s.append(p, buffer + sizeof(buffer) - p);
+	}
+}
+
+const char* const openmetrics_writer::content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+void openmetrics_writer::sample(family f, const string& labels, double value)
+{
+	string& s = _families[f];
+	s += families[f].name;
+	s.push_back('{');
+	s += labels;
+	s += "} ";
+	append_number(s, value);
+	s.push_back('\n');
+}
+
+// Bounds are left out where the range or the limit has none.
+void openmetrics_writer::add(const string& host_name, const nagios_host& host)
+{
+	const nagios_host::service_map& services = host.services();
+	nagios_host::service_map::size_type size = services.size();
+	for (nagios_host::service_map::size_type i(0); i < size; ++i)
+	{
+		const nagios_service& service = services[i];
+		_service_labels.clear();
+		append_label(_service_labels, "host", host_name);
+		append_label(_service_labels, "service", service.service_description());
+		sample(service_state, _service_labels, host.states()[i].current_state());
+		vector<nagios_perfdata>::const_iterator end = service.performance_data().end();
+		for (vector<nagios_perfdata>::const_iterator it = service.performance_data().begin(); it != end; ++it)
+		{
+			_metric_labels = _service_labels;
+			append_label(_metric_labels, "label", it->label());
+			append_label(_metric_labels, "uom", it->uom());
+			sample(perfdata_value, _metric_labels, it->value());
+			if (std::isfinite(it->warning().minimum()))
+				sample(warning_minimum, _metric_labels, it->warning().minimum());
+			if (std::isfinite(it->warning().maximum()))
+				sample(warning_maximum, _metric_labels, it->warning().maximum());
+			if (std::isfinite(it->critical().minimum()))
+				sample(critical_minimum, _metric_labels, it->critical().minimum());
+			if (std::isfinite(it->critical().maximum()))
+				sample(critical_maximum, _metric_labels, it->critical().maximum());
+			if (std::isfinite(it->minimum()))
+				sample(minimum, _metric_labels, it->minimum());
+			if (std::isfinite(it->maximum()))
+				sample(maximum, _metric_labels, it->maximum());
+		}
+	}
+}
+
+void openmetrics_writer::finish()
+{
+	for (unsigned f(0); f < family_count; ++f)
+	{
+		_os << "# TYPE " << families[f].name << " gauge\n";
+		_os << "# HELP " << families[f].name << ' ' << families[f].help << '\n';
+		_os.write(_families[f].data(), _families[f].size());
+		string().swap(_families[f]);
+	}
+	_os << "# EOF\n";
+	_os.flush();
+}
@@ -0,0 +1,48 @@
+#ifndef __OPENMETRICS_H
+#define __OPENMETRICS_H
+
+#include <ostream>
+#include <string>
+
+#include "nagios_host.h"
+
+// Writes service states and perfdata in the OpenMetrics text format. The
+// samples of a family must be contiguous, so each family is gathered in a
+// buffer of its own in a single pass over the services, the label set of a
+// service, then of a metric, being escaped once for all of its samples.
+class openmetrics_writer
+{
+public:
+	static const char* const content_type;
+
+private:
+	enum family
+	{
+		service_state,
+		perfdata_value,
+		warning_minimum,
+		warning_maximum,
+		critical_minimum,
+		critical_maximum,
+		minimum,
+		maximum,
+		family_count
+	};
+
+	std::ostream& _os;
+	std::string _families[family_count];
+	std::string _service_labels;
+	std::string _metric_labels;
+
+	void sample(family f, const std::string& labels, double value);
+
+public:
+	explicit openmetrics_writer(std::ostream& os) : _os(os) { }
+
+	// Adds the services of host, labelled host_name.
+	void add(const std::string& host_name, const nagios_host& host);
+	// Writes the families, then the end marker.
+	void finish();
+};
+
+#endif
@@ -0,0 +1,401 @@
+#include "globals.h"
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "json.h"
+#include "nagios_host.h"
+#include "nagios_perfdata.h"
+#include "nagios_service.h"
+#include "nagios_snapshot.h"
+#include "perfdata_history.h"
+#include "strutil.h"
+
+using namespace std;
+
+const size_t perfdata_history::key_size;
+const unsigned perfdata_history::read_attempts;
+const uint32_t perfdata_history::max_metrics;
+
+namespace
+{
+	const char history_magic[8] = { 'N', 'J', 'H', 'I', 'S', 'T', '1', '\0' };
+}
+
+struct perfdata_history::header
+{
+	char magic[8];
+	uint32_t metric_capacity;
+	uint32_t sample_capacity;
+	uint32_t slot_count;
+	uint32_t metric_count;
+	uint32_t dropped;
+	uint32_t reserved;
+};
+
+struct perfdata_history::slot
+{
+	uint64_t hash;
+	uint32_t position; // 0 for an empty slot, metric index + 1 otherwise
+	uint32_t reserved;
+};
+
+// sequence is odd while the writer updates the ring, so that readers retry.
+struct perfdata_history::metric
+{
+	uint32_t sequence;
+	uint32_t head;
+	uint32_t count;
+	uint32_t key_length;
+	char key[key_size];
+};
+
+perfdata_history::~perfdata_history()
+{
+	if (_map)
+		munmap(_map, _size);
+}
+
+uint32_t perfdata_history::slot_count(uint64_t metrics)
+{
+	uint32_t slots = 1;
+	while (slots < metrics * 2)
+		slots <<= 1;
+	return slots;
+}
+
+size_t perfdata_history::layout_size(uint64_t metrics, uint64_t samples)
+{
+	if (!metrics || !samples || metrics > max_metrics || samples > UINT32_MAX)
+		return 0;
+	uint64_t fixed = sizeof(header) + static_cast<uint64_t>(slot_count(metrics)) * sizeof(slot) + metrics * sizeof(metric);
+	uint64_t per_sample = metrics * (sizeof(uint32_t) + sizeof(float));
+	uint64_t limit = static_cast<uint64_t>(numeric_limits<off_t>::max()) < numeric_limits<size_t>::max() ? numeric_limits<off_t>::max() : numeric_limits<size_t>::max();
+	if (samples > (limit - fixed) / per_sample)
+		return 0;
+	return fixed + samples * per_sample;
+}
+
+// A file from elsewhere, or truncated, is refused rather than probed out of
+// its mapping.
+bool perfdata_history::attach(void* map, size_t size)
+{
+	header* h = static_cast<header*>(map);
+	if (size < sizeof(header) || memcmp(h->magic, history_magic, sizeof(history_magic)) != 0 ||
+		layout_size(h->metric_capacity, h->sample_capacity) != size ||
+		h->slot_count != slot_count(h->metric_capacity) || h->metric_count > h->metric_capacity)
+	{
+		munmap(map, size);
+		return false;
+	}
+	_map = map;
+	_size = size;
+	_header = h;
+	_slots = reinterpret_cast<slot*>(h + 1);
+	_metrics = reinterpret_cast<metric*>(_slots + h->slot_count);
+	_times = reinterpret_cast<uint32_t*>(_metrics + h->metric_capacity);
+	_values = reinterpret_cast<float*>(_times + static_cast<size_t>(h->metric_capacity) * h->sample_capacity);
+	return true;
+}
+
+bool perfdata_history::create(const string& path, uint64_t metrics, uint64_t samples)
+{
+	size_t size = layout_size(metrics, samples);
+	if (!size)
+		return false;
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	bool reuse = false;
+	if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) == size)
+	{
+		header h;
+		reuse = pread(fd, &h, sizeof(h), 0) == sizeof(h) && memcmp(h.magic, history_magic, sizeof(history_magic)) == 0 &&
+			h.metric_capacity == metrics && h.sample_capacity == samples;
+	}
+	if (!reuse && (ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0))
+	{
+		close(fd);
+		return false;
+	}
+	void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	if (!reuse)
+	{
+		header* h = static_cast<header*>(map);
+		h->metric_capacity = metrics;
+		h->sample_capacity = samples;
+		h->slot_count = slot_count(metrics);
+		memcpy(h->magic, history_magic, sizeof(history_magic));
+	}
+	if (!attach(map, size))
+		return false;
+	for (uint32_t i(0); i < _header->metric_count; ++i)
+	{
+		metric& m = _metrics[i];
+		m.head %= samples;
+		if (m.count > samples)
+			m.count = samples;
+		if (m.key_length > key_size)
+			m.key_length = key_size;
+		if (m.sequence & 1)
+			__atomic_store_n(&m.sequence, m.sequence + 1, __ATOMIC_RELEASE);
+	}
+	return true;
+}
+
+bool perfdata_history::open(const string& path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void* map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	return map != MAP_FAILED && attach(map, st.st_size);
+}
+
+string perfdata_history::key(const string& host_name, const string& service_description, const string& label)
+{
+	string k(host_name);
+	k.push_back('\0');
+	k += service_description;
+	k.push_back('\0');
+	k += label;
+	return k;
+}
+
+// Keys longer than key_size are only stored truncated, the hash tells them
+// apart.
+const perfdata_history::metric* perfdata_history::find(const string& key, uint64_t hash) const
+{
+	uint32_t mask = _header->slot_count - 1;
+	uint32_t length = key.size() < key_size ? key.size() : key_size;
+	for (uint32_t i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, ++probes)
+	{
+		uint32_t position = __atomic_load_n(&_slots[i].position, __ATOMIC_ACQUIRE);
+		if (!position || position > _header->metric_capacity)
+			return nullptr;
+		const metric& m = _metrics[position - 1];
+		if (_slots[i].hash == hash && m.key_length == length && memcmp(m.key, key.data(), length) == 0)
+			return &m;
+	}
+	return nullptr;
+}
+
+perfdata_history::metric* perfdata_history::insert(const string& key)
+{
+	uint64_t hash = hash_string(key);
+	const metric* found = find(key, hash);
+	if (found)
+		return const_cast<metric*>(found);
+	uint32_t index = _header->metric_count;
+	if (index >= _header->metric_capacity)
+	{
+		++_header->dropped;
+		return nullptr;
+	}
+	metric& m = _metrics[index];
+	m.key_length = key.size() < key_size ? key.size() : key_size;
+	memcpy(m.key, key.data(), m.key_length);
+	m.head = 0;
+	m.count = 0;
+	uint32_t mask = _header->slot_count - 1;
+	uint32_t i = hash & mask;
+	while (_slots[i].position)
+		i = (i + 1) & mask;
+	_slots[i].hash = hash;
+	__atomic_store_n(&_slots[i].position, index + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&_header->metric_count, index + 1, __ATOMIC_RELEASE);
+	return &m;
+}
+
+void perfdata_history::append(const string& key, time_t when, double value)
+{
+	metric* m = insert(key);
+	if (m)
+		append(*m, when, value);
+}
+void perfdata_history::append(metric& m, time_t when, double value)
+{
+	uint32_t samples = _header->sample_capacity;
+	size_t base = static_cast<size_t>(&m - _metrics) * samples;
+	uint32_t sequence = m.sequence;
+	__atomic_store_n(&m.sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	_times[base + m.head] = static_cast<uint32_t>(when);
+	_values[base + m.head] = static_cast<float>(value);
+	m.head = (m.head + 1) % samples;
+	if (m.count < samples)
+		++m.count;
+	__atomic_store_n(&m.sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+namespace
+{
+	// Whether a key of the given length is host_name, service_description
+	// and label. Truncated keys are left to the hash.
+	bool same_key(const char* key, uint32_t length, const string& host_name, const string& service_description, const string& label)
+	{
+		string::size_type h = host_name.size(), s = service_description.size();
+		if (length != h + s + label.size() + 2 || length >= perfdata_history::key_size)
+			return false;
+		return memcmp(key, host_name.data(), h) == 0 && key[h] == '\0' &&
+			memcmp(key + h + 1, service_description.data(), s) == 0 && key[h + 1 + s] == '\0' &&
+			memcmp(key + h + s + 2, label.data(), label.size()) == 0;
+	}
+}
+
+// Each sample first tries the metric the previous record() met at the same
+// place; the key is only built, in a buffer reused for the whole pass, and
+// hashed when that is another one.
+void perfdata_history::record(const nagios_snapshot& snapshot, time_t when)
+{
+	vector<uint32_t> recorded;
+	recorded.reserve(_recorded.size());
+	string k;
+	nagios_snapshot::host_map::const_iterator hend = snapshot.hosts().end();
+	for (nagios_snapshot::host_map::const_iterator host = snapshot.hosts().begin(); host != hend; ++host)
+	{
+		nagios_host::service_map::const_iterator send = host->services().end();
+		for (nagios_host::service_map::const_iterator service = host->services().begin(); service != send; ++service)
+		{
+			string::size_type prefix = 0;
+			vector<nagios_perfdata>::const_iterator pend = service->performance_data().end();
+			for (vector<nagios_perfdata>::const_iterator perfdata = service->performance_data().begin(); perfdata != pend; ++perfdata)
+			{
+				if (std::isnan(perfdata->value()))
+					continue;
+				metric* m = nullptr;
+				if (recorded.size() < _recorded.size())
+				{
+					metric& previous = _metrics[_recorded[recorded.size()]];
+					if (same_key(previous.key, previous.key_length, host->host_name(), service->service_description(), perfdata->label()))
+						m = &previous;
+				}
+				if (!m)
+				{
+					if (!prefix)
+					{
+						k = key(host->host_name(), service->service_description(), string());
+						prefix = k.size();
+					}
+					k.resize(prefix);
+					k += perfdata->label();
+					m = insert(k);
+				}
+				if (!m)
+					continue;
+				recorded.push_back(static_cast<uint32_t>(m - _metrics));
+				append(*m, when, perfdata->value());
+			}
+		}
+	}
+	_recorded.swap(recorded);
+}
+
+json perfdata_history::query(const string& key, time_t start, time_t end, unsigned buckets) const
+{
+	json j;
+	vector<json>& vec = j.vector_value();
+	if (!_map || end <= start || !buckets)
+		return j;
+	const metric* m = find(key, hash_string(key));
+	uint32_t samples = _header->sample_capacity;
+	vector<uint32_t> times;
+	vector<float> values;
+	if (m)
+	{
+		size_t base = static_cast<size_t>(m - _metrics) * samples;
+		bool consistent = false;
+		for (unsigned attempt(0); !consistent && attempt < read_attempts; ++attempt)
+		{
+			if (attempt)
+				this_thread::yield();
+			uint32_t sequence = __atomic_load_n(&m->sequence, __ATOMIC_ACQUIRE);
+			if (sequence & 1)
+				continue;
+			uint32_t head = m->head % samples;
+			uint32_t count = m->count < samples ? m->count : samples;
+			uint32_t first = (head + samples - count) % samples;
+			times.resize(count);
+			values.resize(count);
+			for (uint32_t i(0); i < count; ++i)
+			{
+				times[i] = _times[base + (first + i) % samples];
+				values[i] = _values[base + (first + i) % samples];
+			}
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			consistent = __atomic_load_n(&m->sequence, __ATOMIC_RELAXED) == sequence;
+		}
+		if (!consistent)
+		{
+			times.clear();
+			values.clear();
+		}
+	}
+	vector<unsigned> counts(buckets, 0);
+	vector<double> minimums(buckets, INFINITY), maximums(buckets, -INFINITY), sums(buckets, 0);
+	double span = static_cast<double>(end - start);
+	for (vector<uint32_t>::size_type i(0); i < times.size(); ++i)
+	{
+		time_t t = times[i];
+		if (t < start || t >= end)
+			continue;
+		unsigned b = static_cast<unsigned>((t - start) * buckets / span);
+		if (b >= buckets)
+			b = buckets - 1;
+		++counts[b];
+		sums[b] += values[i];
+		if (values[i] < minimums[b])
+			minimums[b] = values[i];
+		if (values[i] > maximums[b])
+			maximums[b] = values[i];
+	}
+	vec.resize(buckets);
+	for (unsigned b(0); b < buckets; ++b)
+	{
+		map<string, json>& map(vec[b].map_value());
+		map["start"].number_value() = static_cast<double>(start + static_cast<time_t>(b * span / buckets));
+		map["count"].number_value() = counts[b];
+		if (counts[b])
+		{
+			map["minimum"].number_value() = minimums[b];
+			map["maximum"].number_value() = maximums[b];
+			map["average"].number_value() = sums[b] / counts[b];
+		}
+	}
+	return j;
+}
+
+json perfdata_history::stats() const
+{
+	json j;
+	map<string, json>& map(j.map_value());
+	if (!_map)
+		return j;
+	map["metrics"].number_value() = __atomic_load_n(&_header->metric_count, __ATOMIC_ACQUIRE);
+	map["metric_capacity"].number_value() = _header->metric_capacity;
+	map["sample_capacity"].number_value() = _header->sample_capacity;
+	map["dropped_samples"].number_value() = _header->dropped;
+	map["bytes"].number_value() = static_cast<double>(_size);
+	return j;
+}
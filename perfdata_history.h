@@ -0,0 +1,74 @@
+#ifndef __PERFDATA_HISTORY_H
+#define __PERFDATA_HISTORY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "json.h"
+#include "nagios_snapshot.h"
+
+// Recent perfdata values kept in a memory-mapped file, so that the watch
+// mode can append to it and CGI processes can query it. Every metric (host,
+// service, label) owns a ring buffer of samples preallocated at creation:
+// timestamps and values are stored in two separate columns, values as
+// floats. Memory use is fixed by the number of metrics and samples.
+class perfdata_history
+{
+public:
+	static const std::size_t key_size = 240;
+	// Reads of a ring that keeps changing under a query give up after that.
+	static const unsigned read_attempts = 64;
+	// So that slot counts and positions fit in 32 bits.
+	static const std::uint32_t max_metrics = 1u << 30;
+
+private:
+	struct header;
+	struct slot;
+	struct metric;
+
+	void* _map;
+	std::size_t _size;
+	header* _header;
+	slot* _slots;
+	metric* _metrics;
+	std::uint32_t* _times;
+	float* _values;
+	// Metrics in the order the last record() met them, so that the next
+	// finds them without hashing a key, as long as the hosts stay the same.
+	std::vector<std::uint32_t> _recorded;
+
+	bool attach(void* map, std::size_t size);
+	static std::uint32_t slot_count(std::uint64_t metrics);
+	// Size of the file, 0 if the dimensions cannot be stored.
+	static std::size_t layout_size(std::uint64_t metrics, std::uint64_t samples);
+	const metric* find(const std::string& key, std::uint64_t hash) const;
+	metric* insert(const std::string& key);
+	void append(metric& m, std::time_t when, double value);
+
+public:
+	perfdata_history() : _map(nullptr), _size(0), _header(nullptr), _slots(nullptr), _metrics(nullptr), _times(nullptr), _values(nullptr), _recorded() { }
+	~perfdata_history();
+
+	// Opens path for writing, (re)initializing it unless it already has
+	// these dimensions, which are taken as configured and refused when out
+	// of range. A ring a crashed writer left mid-update is released for
+	// readers, this being the only writer.
+	bool create(const std::string& path, std::uint64_t metrics, std::uint64_t samples);
+	bool open(const std::string& path);
+
+	static std::string key(const std::string& host_name, const std::string& service_description, const std::string& label);
+
+	void append(const std::string& key, std::time_t when, double value);
+	void record(const nagios_snapshot& snapshot, std::time_t when);
+
+	// Splits [start, end) into buckets and gives minimum, maximum and
+	// average of the samples of each; no samples if the ring could not be
+	// read consistently in read_attempts.
+	json query(const std::string& key, std::time_t start, std::time_t end, unsigned buckets) const;
+	json stats() const;
+};
+
+#endif
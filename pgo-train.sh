@@ -0,0 +1,91 @@
+#!/bin/sh
+# Training run for "make pgo": generates a synthetic poller, status.dat and
+# objects.cache, in a directory and runs the binary over it the ways it is
+# used, so that the profile covers reading, parsing and every encoding.
+#
+# Usage: pgo-train.sh binary directory [hosts]
+
+binary=$1
+dir=$2
+hosts=${3:-3000}
+if [ -z "$binary" ] || [ -z "$dir" ]; then
+	echo "Usage: $0 binary directory [hosts]" >&2
+	exit 1
+fi
+mkdir -p "$dir" || exit 1
+
+# 20 services per host with the perfdata shapes plugins write, quoted
+# labels, ranges, U values, and one in a hundred malformed on purpose.
+awk -v hosts="$hosts" -v dir="$dir" 'BEGIN {
+	srand(42)
+	perf[0] = ""
+	perf[1] = "rta=0.500000ms;100.000000;500.000000;0.000000 pl=0%;20;60;0"
+	perf[2] = "\x27/ used\x27=1234MB;8000;9000;0;10000 \x27/boot\x27=55MB;;;0;100"
+	perf[3] = "load1=0.150;5.000;10.000;0; load5=0.210;4.000;6.000;0; load15=0.180;3.000;4.000;0;"
+	perf[4] = "time=0.012s;1;2;0; size=4521B;;;0"
+	perf[5] = "users=3;@5:10;~:20;0"
+	perf[6] = "val=U;;;;"
+	perf[7] = "\x27it\x27\x27s\x27=42c;10:;20:;;"
+	perf[8] = "x=1,5;;;;"
+	bad[0] = "rta=1ms;oops"
+	bad[1] = "time=abc"
+	bad[2] = "\x27unterminated=1"
+	status = dir "/status.dat"
+	objects = dir "/objects.cache"
+	print "info {\n\tcreated=1700000000\n\tversion=4.4.6\n\t}\n" > status
+	print "define timeperiod {\n\ttimeperiod_name\t24x7\n\t}\n" > objects
+	for (h = 0; h < hosts; ++h) {
+		name = sprintf("srv%06d", h)
+		printf "define host {\n\thost_name\t%s\n\talias\t%sAlias %s\n\tdisplay_name\tDisp %s\n\ticon_image\tlinux.png\n\tcheck_period\t24x7\n\t}\n\n", name, h % 2 ? "n" : "m", name, name > objects
+		printf "hoststatus {\n\thost_name=%s\n\tcheck_period=24x7\n\tactive_checks_enabled=1\n\tcurrent_state=%d\n\tstate_type=1\n\tplugin_output=PING OK - Packet loss = 0%%, RTA = 0.50 ms\n\tperformance_data=%s\n\tis_flapping=0\n\tlast_check=1700000000\n\tlast_state_change=%d\n\t}\n\n", name, rand() < 0.05, perf[1], 1699900000 + int(rand() * 100000) > status
+		for (s = 0; s < 20; ++s) {
+			r = rand()
+			state = r < 0.85 ? 0 : r < 0.92 ? 1 : r < 0.97 ? 2 : 3
+			p = rand() < 0.01 ? bad[int(rand() * 3)] : perf[int(rand() * 9)]
+			printf "servicestatus {\n\thost_name=%s\n\tservice_description=Service %03d / \"q\"\n\tcheck_period=24x7\n\tcurrent_state=%d\n\tstate_type=%d\n\tplugin_output=OK - output %d with \\ backslash\n\tlong_plugin_output=\n\tperformance_data=%s\n\tis_flapping=%d\n\tlast_check=1700000000\n\tlast_state_change=%d\n\t}\n\n", name, s, state, rand() < 0.7, s, p, rand() < 0.02, 1699900000 + int(rand() * 100000) > status
+		}
+	}
+}'
+
+cat > "$dir/nagios-json.conf" <<EOF
+status-file=$dir/status.dat
+objects-file=$dir/objects.cache
+users.prefix.host-prefix=srv0001
+users.alias.alias-prefix=n
+EOF
+{ cat "$dir/nagios-json.conf"; echo stream=1; } > "$dir/stream.conf"
+cat > "$dir/instances.conf" <<EOF
+instances.east.status-file=$dir/status.dat
+instances.east.objects-file=$dir/objects.cache
+instances.east.host-prefix=east-
+instances.west.status-file=$dir/status.dat
+instances.west.objects-file=$dir/objects.cache
+instances.west.host-prefix=west-
+EOF
+
+# binary writes to stdout and returns 1 on success, so only the output is
+# checked.
+run()
+{
+	conf=$1
+	shift
+	env "$@" "$binary" "$dir/$conf" > "$dir/out"
+	if [ ! -s "$dir/out" ]; then
+		echo "No output from $binary $dir/$conf with $*" >&2
+		exit 1
+	fi
+}
+
+for accept in application/json application/msgpack application/cbor application/x-ndjson; do
+	run nagios-json.conf HTTP_ACCEPT=$accept
+	run nagios-json.conf HTTP_ACCEPT=$accept QUERY_STRING=columns
+done
+for query in summary "summary&hosts" metrics problems "problems&limit=500" "limit=100" "limit=100&after=c3J2MDAwNTAw"; do
+	run nagios-json.conf QUERY_STRING="$query"
+done
+run nagios-json.conf REMOTE_USER=prefix
+run nagios-json.conf REMOTE_USER=alias
+run stream.conf
+run stream.conf QUERY_STRING=ndjson
+run instances.conf
+rm -f "$dir/out"
@@ -0,0 +1,133 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// Hands items over from one stage of a pipeline to the next. A producer
+// blocks while capacity items are waiting, so that a stage never runs
+// further ahead of the next than that; items are meant to be batches, for
+// the lock to be taken once per batch rather than per record.
+template<typename T>
+class bounded_queue
+{
+private:
+	std::deque<T> _items;
+	std::size_t _capacity;
+	std::mutex _mutex;
+	std::condition_variable _not_full;
+	std::condition_variable _not_empty;
+	bool _closed;
+
+public:
+	explicit bounded_queue(std::size_t capacity) : _items(), _capacity(capacity), _mutex(), _not_full(), _not_empty(), _closed(false) { }
+
+	// Returns false, dropping item, once the queue is closed.
+	bool push(T&& item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_not_full.wait(lock, [this]() { return _closed || _items.size() < _capacity; });
+		if (_closed)
+			return false;
+		_items.push_back(std::move(item));
+		_not_empty.notify_one();
+		return true;
+	}
+	// Returns false once the queue is closed and drained.
+	bool pop(T& item)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_not_empty.wait(lock, [this]() { return _closed || !_items.empty(); });
+		if (_items.empty())
+			return false;
+		item = std::move(_items.front());
+		_items.pop_front();
+		_not_full.notify_one();
+		return true;
+	}
+	// Called by the producer once done, or by the consumer to stop it.
+	void close()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_closed = true;
+		_not_full.notify_all();
+		_not_empty.notify_all();
+	}
+};
+
+// A stage of a pipeline: a source filling a batch (a container) at a time,
+// and returning false once it has nothing left. Threaded, the source runs
+// on a thread of its own, up to depth batches ahead of the consumer, and
+// what it throws is rethrown to the consumer once the batches before are
+// taken; otherwise the consumer calls it. A single core gains nothing from
+// threads but the cost of passing batches from one cache to another.
+template<typename Batch>
+class pipeline_stage
+{
+public:
+	typedef std::function<bool(Batch&)> source;
+
+	static const std::size_t depth = 4;
+
+private:
+	source _source;
+	bounded_queue<Batch> _queue;
+	std::exception_ptr _error;
+	std::thread _thread;
+
+	void run()
+	{
+		try
+		{
+			Batch batch;
+			while (_source(batch) && _queue.push(std::move(batch)))
+				batch.clear();
+		}
+		catch (...)
+		{
+			_error = std::current_exception();
+		}
+		_queue.close();
+	}
+
+public:
+	pipeline_stage(const source& s, bool threaded) : _source(s), _queue(depth), _error(), _thread()
+	{
+		if (threaded)
+			_thread = std::thread(&pipeline_stage::run, this);
+	}
+	// A consumer that stops early stops the source.
+	~pipeline_stage()
+	{
+		if (_thread.joinable())
+		{
+			_queue.close();
+			_thread.join();
+		}
+	}
+
+	// Replaces batch with the next one; false past the last.
+	bool next(Batch& batch)
+	{
+		batch.clear();
+		if (!_thread.joinable())
+			return _source(batch);
+		if (_queue.pop(batch))
+			return true;
+		_thread.join();
+		if (_error)
+			std::rethrow_exception(_error);
+		return false;
+	}
+};
+
+template<typename Batch>
+const std::size_t pipeline_stage<Batch>::depth;
+
+#endif
@@ -0,0 +1,190 @@
+#include "globals.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "response_cache.h"
+#include "strutil.h"
+
+using namespace std;
+
+namespace
+{
+	string hex(uint64_t value)
+	{
+		char buf[17];
+		snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(value));
+		return buf;
+	}
+
+	// Nagios replaces its files by renaming a new one over the old, so the
+	// inode changes along with size and modification time.
+	string file_generation(const string& path)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+			return path + ":missing";
+		char buf[128];
+		snprintf(buf, sizeof(buf), ":%llu:%llu:%lld:%lld.%09ld",
+			static_cast<unsigned long long>(st.st_dev), static_cast<unsigned long long>(st.st_ino),
+			static_cast<long long>(st.st_size), static_cast<long long>(st.st_mtim.tv_sec), st.st_mtim.tv_nsec);
+		return path + buf;
+	}
+}
+
+response_cache::response_cache(const string& directory, const vector<string>& sources, const string& variant) : _directory(directory), _generation(), _name(), _temp_path(), _lock_fd(-1)
+{
+	_generation = generation(sources);
+	_name = _generation + "-" + hex(hash_string(variant));
+	if (_directory.size() && _directory[_directory.size() - 1] != '/')
+		_directory.push_back('/');
+	_temp_path = _directory + _name + ".tmp." + to_string(getpid());
+}
+
+string response_cache::generation(const vector<string>& sources)
+{
+	string generation;
+	vector<string>::const_iterator end = sources.end();
+	for (vector<string>::const_iterator it = sources.begin(); it != end; ++it)
+		generation += file_generation(*it) + "\n";
+	return hex(hash_string(generation));
+}
+
+response_cache::~response_cache()
+{
+	if (_lock_fd >= 0)
+		close(_lock_fd);
+}
+
+int response_cache::open() const
+{
+	return ::open((_directory + _name).c_str(), O_RDONLY | O_CLOEXEC);
+}
+
+// The lock file may be unlinked by a prune while this process waits for
+// it, in which case the lock is taken again on the one now in place.
+bool response_cache::lock()
+{
+	string path(_directory + _name + ".lock");
+	for (; ; )
+	{
+		if (_lock_fd < 0)
+			_lock_fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+		if (_lock_fd < 0)
+			return false;
+		while (flock(_lock_fd, LOCK_EX) != 0)
+			if (errno != EINTR)
+				return false;
+		struct stat locked, current;
+		if (fstat(_lock_fd, &locked) == 0 && stat(path.c_str(), &current) == 0 && locked.st_dev == current.st_dev && locked.st_ino == current.st_ino)
+			return true;
+		close(_lock_fd);
+		_lock_fd = -1;
+	}
+}
+
+int response_cache::commit()
+{
+	// Opened before the rename: should a concurrent prune unlink the entry,
+	// this process can still serve what it rendered.
+	int fd = ::open(_temp_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	if (rename(_temp_path.c_str(), (_directory + _name).c_str()) != 0)
+		unlink(_temp_path.c_str());
+	else
+		prune();
+	return fd;
+}
+
+void response_cache::abandon()
+{
+	unlink(_temp_path.c_str());
+	if (_lock_fd >= 0)
+	{
+		close(_lock_fd);
+		_lock_fd = -1;
+	}
+}
+
+// Entries of other generations go. Their lock files and temporary files
+// only once no process holds the lock, that is once their render is over:
+// a lock file is unlinked while this process holds it itself.
+void response_cache::prune() const
+{
+	DIR* dir = opendir(_directory.c_str());
+	if (!dir)
+		return;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != nullptr)
+	{
+		string name(entry->d_name);
+		if (name.size() < _generation.size() + 1 || name[_generation.size()] != '-')
+			continue;
+		if (name.compare(0, _generation.size(), _generation) == 0)
+			continue;
+		string::size_type dot = name.find('.');
+		if (dot == string::npos)
+		{
+			unlink((_directory + name).c_str());
+			continue;
+		}
+		// The lock file or a temporary file of the entry before the dot.
+		int fd = ::open((_directory + name.substr(0, dot) + ".lock").c_str(), O_RDWR | O_CLOEXEC);
+		if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) != 0)
+		{
+			close(fd);
+			continue;
+		}
+		unlink((_directory + name).c_str());
+		if (fd >= 0)
+			close(fd);
+	}
+	closedir(dir);
+}
+
+bool response_cache::send(int fd, int out_fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+		return false;
+	off_t offset = 0;
+	while (offset < st.st_size)
+	{
+		ssize_t sent = sendfile(out_fd, fd, &offset, st.st_size - offset);
+		if (sent > 0)
+			continue;
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent == 0 || (errno != EINVAL && errno != ENOSYS))
+			return false;
+		// sendfile() does not support this output, copy by hand
+		char buf[65536];
+		ssize_t n;
+		while ((n = pread(fd, buf, sizeof(buf), offset)) > 0)
+		{
+			for (ssize_t written = 0; written < n; )
+			{
+				ssize_t w = write(out_fd, buf + written, n - written);
+				if (w < 0 && errno == EINTR)
+					continue;
+				if (w <= 0)
+					return false;
+				written += w;
+			}
+			offset += n;
+		}
+		return n == 0;
+	}
+	return true;
+}
@@ -0,0 +1,44 @@
+#ifndef __RESPONSE_CACHE_H
+#define __RESPONSE_CACHE_H
+
+#include <string>
+#include <vector>
+
+// Rendered responses stored in a directory, one file per generation of the
+// source files and per variant (user filter, encoding). Entries are written
+// to a temporary file then renamed into place; regeneration is serialized by
+// an advisory lock so that concurrent requests parse the sources only once.
+class response_cache
+{
+private:
+	std::string _directory;
+	std::string _generation;
+	std::string _name;
+	std::string _temp_path;
+	int _lock_fd;
+
+	void prune() const;
+
+public:
+	response_cache(const std::string& directory, const std::vector<std::string>& sources, const std::string& variant);
+	~response_cache();
+
+	// Identifies the current contents of the source files.
+	static std::string generation(const std::vector<std::string>& sources);
+
+	inline const std::string& temp_path() const { return _temp_path; }
+
+	// Returns a readable descriptor on the entry, or -1 if there is none.
+	int open() const;
+	// Blocks until this process is the only one allowed to regenerate.
+	bool lock();
+	// Moves temp_path() into place and drops entries of older generations.
+	// Returns a readable descriptor on the new entry, or -1.
+	int commit();
+	// Drops temp_path() and releases the lock, after a failed render.
+	void abandon();
+
+	static bool send(int fd, int out_fd);
+};
+
+#endif
@@ -0,0 +1,492 @@
+#include "globals.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "json.h"
+#include "serializer.h"
+#include "strutil.h"
+
+using namespace std;
+
+namespace
+{
+	inline void put_be(ostream& os, uint64_t value, int bytes)
+	{
+		char buf[8];
+		for (int i = bytes - 1; i >= 0; --i)
+		{
+			buf[i] = static_cast<char>(value & 0xFF);
+			value >>= 8;
+		}
+		os.write(buf, bytes);
+	}
+	inline void put_double(ostream& os, double value)
+	{
+		uint64_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		put_be(os, bits, 8);
+	}
+	inline bool is_integer(double value, long long& llvalue)
+	{
+		if (!(value >= -9223372036854775808.0 && value < 9223372036854775808.0))
+			return false;
+		llvalue = static_cast<long long>(value);
+		return llvalue == value;
+	}
+}
+
+void serializer::write(const json& value)
+{
+	switch (value.type())
+	{
+		case JSON_TYPE_NUMBER :
+			number_value(value.number_value());
+			break;
+		case JSON_TYPE_STRING :
+			string_value(value.string_value());
+			break;
+		case JSON_TYPE_VECTOR :
+			{
+				const json::vector_type& vec = value.vector_value();
+				begin_vector(vec.size());
+				json::vector_type::const_iterator vend = vec.end();
+				for (json::vector_type::const_iterator it = vec.begin(); it != vend; ++it)
+					write(*it);
+				end_vector();
+			}
+			break;
+		case JSON_TYPE_MAP :
+			{
+				const json::map_type& map = value.map_value();
+				begin_map(map.size());
+				json::map_type::const_iterator mend = map.end();
+				for (json::map_type::const_iterator it = map.begin(); it != mend; ++it)
+				{
+					key(it->first);
+					write(it->second);
+				}
+				end_map();
+			}
+			break;
+		default :
+			null_value();
+			break;
+	}
+}
+
+void json_serializer::separate()
+{
+	if (_after_key)
+		_after_key = false;
+	else if (!_first.empty())
+	{
+		if (_first.back())
+			_first.back() = false;
+		else if (_split && _first.size() == 1)
+			_os << '\n';
+		else
+			_os << ',';
+	}
+}
+void json_serializer::put_string(const string& s)
+{
+	_os << '"';
+	string::const_iterator end = s.end();
+	for (string::const_iterator it = s.begin(); it != end; ++it)
+	{
+		char c = *it;
+		switch (c)
+		{
+			case '\\' :
+			case '"' :
+			case '/' :
+				_os << '\\' << c;
+				break;
+			case '\b' :
+				_os << '\\' << 'b';
+				break;
+			case '\f' :
+				_os << '\\' << 'f';
+				break;
+			case '\n' :
+				_os << '\\' << 'n';
+				break;
+			case '\r' :
+				_os << '\\' << 'r';
+				break;
+			case '\t' :
+				_os << '\\' << 't';
+				break;
+			default :
+				_os << c;
+				break;
+		}
+	}
+	_os << '"';
+}
+void json_serializer::null_value()
+{
+	separate();
+	_os << "null";
+}
+void json_serializer::number_value(double value)
+{
+	separate();
+	long long llvalue(value);
+	if (llvalue == value)
+		_os << llvalue;
+	else
+		_os << to_string(value);
+}
+void json_serializer::string_value(const string& value)
+{
+	separate();
+	put_string(value);
+}
+void json_serializer::begin_vector(size_type size)
+{
+	separate();
+	if (_lines && _first.empty())
+		_split = true;
+	else
+		_os << '[';
+	_first.push_back(true);
+}
+void json_serializer::end_vector()
+{
+	bool empty = _first.back();
+	_first.pop_back();
+	if (_split && _first.empty())
+		_blank = empty;
+	else
+		_os << ']';
+}
+void json_serializer::begin_sequence()
+{
+	if (_lines && _first.empty())
+		_split = true;
+	_first.push_back(true);
+}
+void json_serializer::begin_map(size_type size)
+{
+	separate();
+	_os << '{';
+	_first.push_back(true);
+}
+void json_serializer::key(const string& name)
+{
+	separate();
+	put_string(name);
+	_os << ':';
+	_after_key = true;
+}
+void json_serializer::end_map()
+{
+	_first.pop_back();
+	_os << '}';
+}
+void json_serializer::raw_values(const string& encoded, size_type count)
+{
+	if (!count)
+		return;
+	separate();
+	_os.write(encoded.data(), encoded.size());
+}
+void json_serializer::finish()
+{
+	if (_blank)
+		_os.flush();
+	else
+		_os << endl;
+}
+
+ostream& operator <<(ostream& os, const json& value)
+{
+	json_serializer(os).write(value);
+	return os;
+}
+
+void msgpack_serializer::put_header(unsigned char fix, unsigned char fix_limit, unsigned char base16, uint64_t size)
+{
+	if (size < fix_limit)
+		_os.put(static_cast<char>(fix | size));
+	else if (size <= 0xFFFF)
+	{
+		_os.put(static_cast<char>(base16));
+		put_be(_os, size, 2);
+	}
+	else
+	{
+		_os.put(static_cast<char>(base16 + 1));
+		put_be(_os, size, 4);
+	}
+}
+void msgpack_serializer::null_value()
+{
+	_os.put(static_cast<char>(0xC0));
+}
+void msgpack_serializer::number_value(double value)
+{
+	long long llvalue;
+	if (!is_integer(value, llvalue))
+	{
+		_os.put(static_cast<char>(0xCB));
+		put_double(_os, value);
+	}
+	else if (llvalue >= 0)
+	{
+		uint64_t u = llvalue;
+		if (u < 0x80)
+			_os.put(static_cast<char>(u));
+		else if (u <= 0xFF)
+		{
+			_os.put(static_cast<char>(0xCC));
+			put_be(_os, u, 1);
+		}
+		else if (u <= 0xFFFF)
+		{
+			_os.put(static_cast<char>(0xCD));
+			put_be(_os, u, 2);
+		}
+		else if (u <= 0xFFFFFFFFULL)
+		{
+			_os.put(static_cast<char>(0xCE));
+			put_be(_os, u, 4);
+		}
+		else
+		{
+			_os.put(static_cast<char>(0xCF));
+			put_be(_os, u, 8);
+		}
+	}
+	else if (llvalue >= -32)
+		_os.put(static_cast<char>(llvalue));
+	else if (llvalue >= -0x80)
+	{
+		_os.put(static_cast<char>(0xD0));
+		put_be(_os, static_cast<uint64_t>(llvalue), 1);
+	}
+	else if (llvalue >= -0x8000)
+	{
+		_os.put(static_cast<char>(0xD1));
+		put_be(_os, static_cast<uint64_t>(llvalue), 2);
+	}
+	else if (llvalue >= -0x80000000LL)
+	{
+		_os.put(static_cast<char>(0xD2));
+		put_be(_os, static_cast<uint64_t>(llvalue), 4);
+	}
+	else
+	{
+		_os.put(static_cast<char>(0xD3));
+		put_be(_os, static_cast<uint64_t>(llvalue), 8);
+	}
+}
+void msgpack_serializer::string_value(const string& value)
+{
+	string::size_type size = value.size();
+	if (size < 32)
+		_os.put(static_cast<char>(0xA0 | size));
+	else if (size <= 0xFF)
+	{
+		_os.put(static_cast<char>(0xD9));
+		put_be(_os, size, 1);
+	}
+	else
+		put_header(0xA0, 0, 0xDA, size);
+	_os.write(value.data(), size);
+}
+void msgpack_serializer::begin_vector(size_type size)
+{
+	put_header(0x90, 16, 0xDC, size);
+}
+void msgpack_serializer::begin_map(size_type size)
+{
+	put_header(0x80, 16, 0xDE, size);
+}
+
+void cbor_serializer::put_header(unsigned char major, uint64_t argument)
+{
+	major <<= 5;
+	if (argument < 24)
+		_os.put(static_cast<char>(major | argument));
+	else if (argument <= 0xFF)
+	{
+		_os.put(static_cast<char>(major | 24));
+		put_be(_os, argument, 1);
+	}
+	else if (argument <= 0xFFFF)
+	{
+		_os.put(static_cast<char>(major | 25));
+		put_be(_os, argument, 2);
+	}
+	else if (argument <= 0xFFFFFFFFULL)
+	{
+		_os.put(static_cast<char>(major | 26));
+		put_be(_os, argument, 4);
+	}
+	else
+	{
+		_os.put(static_cast<char>(major | 27));
+		put_be(_os, argument, 8);
+	}
+}
+void cbor_serializer::null_value()
+{
+	_os.put(static_cast<char>(0xF6));
+}
+void cbor_serializer::number_value(double value)
+{
+	long long llvalue;
+	if (!is_integer(value, llvalue))
+	{
+		_os.put(static_cast<char>(0xFB));
+		put_double(_os, value);
+	}
+	else if (llvalue >= 0)
+		put_header(0, llvalue);
+	else
+		put_header(1, static_cast<uint64_t>(-1 - llvalue));
+}
+void cbor_serializer::string_value(const string& value)
+{
+	put_header(3, value.size());
+	_os.write(value.data(), value.size());
+}
+void cbor_serializer::begin_vector(size_type size)
+{
+	put_header(4, size);
+}
+void cbor_serializer::begin_map(size_type size)
+{
+	put_header(5, size);
+}
+
+namespace
+{
+	// The media types of each format, in the order of serialization_format.
+	const char* const media_types[][4] = {
+		{ "application/json", nullptr },
+		{ "application/msgpack", "application/x-msgpack", "application/vnd.msgpack", nullptr },
+		{ "application/cbor", nullptr },
+		{ "application/x-ndjson", "application/ndjson", nullptr }
+	};
+	const int format_count = sizeof(media_types) / sizeof(media_types[0]);
+
+	// How closely range, lowercased, names format: 3 for the type itself, 2
+	// for application/*, 1 for */*, 0 otherwise. NDJSON changes the shape of
+	// the output, so it has to be asked for by name.
+	int specificity(const string& range, int format)
+	{
+		for (const char* const* type = media_types[format]; *type; ++type)
+			if (range == *type)
+				return 3;
+		if (format == format_ndjson)
+			return 0;
+		return range == "application/*" ? 2 : range == "*/*" ? 1 : 0;
+	}
+	// qvalue = ( "0" [ "." 0*3DIGIT ] ) / ( "1" [ "." 0*3("0") ] ), in
+	// thousandths.
+	bool parse_qvalue(const string& s, int& q)
+	{
+		if (s.empty() || (s[0] != '0' && s[0] != '1') || s.size() > 5 || (s.size() > 1 && s[1] != '.'))
+			return false;
+		q = (s[0] - '0') * 1000;
+		for (string::size_type i = 2, scale = 100; i < s.size(); ++i, scale /= 10)
+		{
+			if (!isdigit(static_cast<unsigned char>(s[i])))
+				return false;
+			q += (s[i] - '0') * scale;
+		}
+		return q <= 1000;
+	}
+}
+
+// Accept: application/msgpack;q=0.9, application/json;q=0.5, */*;q=0.1
+// Each format takes the weight of the most specific range that names it,
+// and the one of highest weight wins, ties going to the first range listed
+// and then to JSON. A range with an invalid q is left out. JSON when no
+// format is acceptable.
+serialization_format negotiate_format(const string& accept)
+{
+	int q[format_count], matched[format_count], order[format_count];
+	for (int format = 0; format < format_count; ++format)
+		matched[format] = 0;
+	string::size_type pos = 0;
+	for (int n = 0; pos < accept.size(); ++n)
+	{
+		string::size_type end = accept.find(',', pos);
+		if (end == string::npos)
+			end = accept.size();
+		string range(accept.substr(pos, end - pos));
+		pos = end + 1;
+		for (string::iterator it = range.begin(); it != range.end(); ++it)
+			*it = tolower(*it);
+		int weight = 1000;
+		bool valid = true;
+		string::size_type params = range.find(';');
+		for (string::size_type param = params; param != string::npos && valid; )
+		{
+			string::size_type next = range.find(';', param + 1);
+			string::size_type equal = range.find('=', param + 1);
+			if (equal != string::npos && equal < next)
+			{
+				string name(range.substr(param + 1, equal - param - 1));
+				trim(name);
+				if (name == "q")
+				{
+					string value(range.substr(equal + 1, next == string::npos ? string::npos : next - equal - 1));
+					trim(value);
+					valid = parse_qvalue(value, weight);
+				}
+			}
+			param = next;
+		}
+		if (!valid)
+			continue;
+		if (params != string::npos)
+			range.erase(params);
+		trim(range);
+		for (int format = 0; format < format_count; ++format)
+		{
+			int s = specificity(range, format);
+			if (s > matched[format])
+			{
+				matched[format] = s;
+				q[format] = weight;
+				order[format] = n;
+			}
+		}
+	}
+	int best = format_json;
+	bool found = false;
+	for (int format = 0; format < format_count; ++format)
+		if (matched[format] && q[format] > 0 && (!found || q[format] > q[best] || (q[format] == q[best] && order[format] < order[best])))
+		{
+			best = format;
+			found = true;
+		}
+	return static_cast<serialization_format>(best);
+}
+
+unique_ptr<serializer> make_serializer(serialization_format format, ostream& os)
+{
+	switch (format)
+	{
+		case format_msgpack :
+			return unique_ptr<serializer>(new msgpack_serializer(os));
+		case format_cbor :
+			return unique_ptr<serializer>(new cbor_serializer(os));
+		case format_ndjson :
+			return unique_ptr<serializer>(new ndjson_serializer(os));
+		default :
+			return unique_ptr<serializer>(new json_serializer(os));
+	}
+}
@@ -0,0 +1,159 @@
+#ifndef __SERIALIZER_H
+#define __SERIALIZER_H
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "json.h"
+
+enum serialization_format
+{
+	format_json,
+	format_msgpack,
+	format_cbor,
+	format_ndjson
+};
+
+// Event-based writer shared by every output encoding. Containers announce
+// their size up front, as the binary encodings need it in their headers.
+class serializer
+{
+public:
+	typedef std::vector<json>::size_type size_type;
+
+protected:
+	std::ostream& _os;
+
+public:
+	explicit serializer(std::ostream& os) : _os(os) { }
+	virtual ~serializer() { }
+
+	virtual const char* content_type() const = 0;
+	// Whether containers must be given their actual size up front.
+	virtual bool sized() const { return true; }
+
+	virtual void null_value() = 0;
+	virtual void number_value(double value) = 0;
+	virtual void string_value(const std::string& value) = 0;
+	virtual void begin_vector(size_type size) = 0;
+	virtual void end_vector() = 0;
+	virtual void begin_map(size_type size) = 0;
+	virtual void key(const std::string& name) = 0;
+	virtual void end_map() = 0;
+	virtual void finish() { _os.flush(); }
+	inline void flush() { _os.flush(); }
+
+	// A serializer of the same encoding, writing to os.
+	virtual std::unique_ptr<serializer> spawn(std::ostream& os) const = 0;
+	// Values written between these are not wrapped in a container, so that
+	// they can be spliced into one by raw_values().
+	virtual void begin_sequence() { }
+	virtual void end_sequence() { }
+	// Adds count values encoded beforehand as a sequence, by a serializer
+	// spawned from this one, to the current container.
+	virtual void raw_values(const std::string& encoded, size_type count) { _os.write(encoded.data(), encoded.size()); }
+
+	void write(const json& value);
+};
+
+class json_serializer : public serializer
+{
+private:
+	std::vector<bool> _first;
+	bool _after_key;
+	bool _lines;
+	bool _split; // the top-level vector is being written as lines
+	bool _blank; // and it had no element
+
+	void separate();
+	void put_string(const std::string& s);
+
+protected:
+	// With lines set, the elements of a top-level vector are written one per
+	// line rather than within brackets.
+	json_serializer(std::ostream& os, bool lines) : serializer(os), _first(), _after_key(false), _lines(lines), _split(false), _blank(false) { }
+
+public:
+	explicit json_serializer(std::ostream& os) : serializer(os), _first(), _after_key(false), _lines(false), _split(false), _blank(false) { }
+
+	virtual const char* content_type() const { return "application/json; charset=utf-8"; }
+	virtual bool sized() const { return false; }
+
+	virtual void null_value();
+	virtual void number_value(double value);
+	virtual void string_value(const std::string& value);
+	virtual void begin_vector(size_type size);
+	virtual void end_vector();
+	virtual void begin_map(size_type size);
+	virtual void key(const std::string& name);
+	virtual void end_map();
+	virtual void finish();
+
+	virtual std::unique_ptr<serializer> spawn(std::ostream& os) const { return std::unique_ptr<serializer>(new json_serializer(os, _lines)); }
+	virtual void begin_sequence();
+	virtual void end_sequence() { _first.pop_back(); }
+	virtual void raw_values(const std::string& encoded, size_type count);
+};
+
+// Newline-delimited JSON: a list of hosts becomes a host per line, that
+// clients can parse as it comes; any other value is a single line.
+class ndjson_serializer : public json_serializer
+{
+public:
+	explicit ndjson_serializer(std::ostream& os) : json_serializer(os, true) { }
+
+	virtual const char* content_type() const { return "application/x-ndjson; charset=utf-8"; }
+};
+
+class msgpack_serializer : public serializer
+{
+private:
+	void put_header(unsigned char fix, unsigned char fix_limit, unsigned char base16, std::uint64_t size);
+
+public:
+	explicit msgpack_serializer(std::ostream& os) : serializer(os) { }
+
+	virtual const char* content_type() const { return "application/msgpack"; }
+
+	virtual void null_value();
+	virtual void number_value(double value);
+	virtual void string_value(const std::string& value);
+	virtual void begin_vector(size_type size);
+	virtual void end_vector() { }
+	virtual void begin_map(size_type size);
+	virtual void key(const std::string& name) { string_value(name); }
+	virtual void end_map() { }
+
+	virtual std::unique_ptr<serializer> spawn(std::ostream& os) const { return std::unique_ptr<serializer>(new msgpack_serializer(os)); }
+};
+
+class cbor_serializer : public serializer
+{
+private:
+	void put_header(unsigned char major, std::uint64_t argument);
+
+public:
+	explicit cbor_serializer(std::ostream& os) : serializer(os) { }
+
+	virtual const char* content_type() const { return "application/cbor"; }
+
+	virtual void null_value();
+	virtual void number_value(double value);
+	virtual void string_value(const std::string& value);
+	virtual void begin_vector(size_type size);
+	virtual void end_vector() { }
+	virtual void begin_map(size_type size);
+	virtual void key(const std::string& name) { string_value(name); }
+	virtual void end_map() { }
+
+	virtual std::unique_ptr<serializer> spawn(std::ostream& os) const { return std::unique_ptr<serializer>(new cbor_serializer(os)); }
+};
+
+// Picks the encoding preferred by an HTTP Accept header, JSON by default.
+serialization_format negotiate_format(const std::string& accept);
+std::unique_ptr<serializer> make_serializer(serialization_format format, std::ostream& os);
+
+#endif
@@ -0,0 +1,99 @@
+#include "globals.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "host_filter.h"
+#include "nagios_snapshot.h"
+#include "snapshot_image.h"
+
+using namespace std;
+
+namespace
+{
+	const char image_magic[8] = { 'N', 'J', 'S', 'N', 'A', 'P', '3', '\0' };
+}
+
+struct snapshot_image::header
+{
+	char magic[8];
+	char generation[16];
+	uint64_t length;
+};
+
+snapshot_image::~snapshot_image()
+{
+	if (_map)
+		munmap(_map, _size);
+}
+
+bool snapshot_image::publish(const string& path, const string& generation, const nagios_snapshot& snapshot)
+{
+	string image(sizeof(header), '\0');
+	snapshot.write_image(image);
+	header h;
+	memcpy(h.magic, image_magic, sizeof(image_magic));
+	memset(h.generation, 0, sizeof(h.generation));
+	memcpy(h.generation, generation.data(), generation.size() < sizeof(h.generation) ? generation.size() : sizeof(h.generation));
+	h.length = image.size() - sizeof(header);
+	memcpy(&image[0], &h, sizeof(h));
+	string temp_path(path + ".tmp." + to_string(getpid()));
+	int fd = ::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return false;
+	string::size_type written = 0;
+	while (written < image.size())
+	{
+		ssize_t w = write(fd, image.data() + written, image.size() - written);
+		if (w <= 0)
+			break;
+		written += w;
+	}
+	if (close(fd) != 0 || written != image.size() || rename(temp_path.c_str(), path.c_str()) != 0)
+	{
+		unlink(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+bool snapshot_image::open(const string& path, const string& generation)
+{
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	void* map = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(header))
+		map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+	const header* h = static_cast<const header*>(map);
+	if (memcmp(h->magic, image_magic, sizeof(image_magic)) != 0 || h->length != st.st_size - sizeof(header) ||
+		generation.compare(0, string::npos, h->generation, strnlen(h->generation, sizeof(h->generation))) != 0)
+	{
+		munmap(map, st.st_size);
+		return false;
+	}
+	if (_map)
+		munmap(_map, _size);
+	_map = map;
+	_size = st.st_size;
+	return true;
+}
+
+bool snapshot_image::load(nagios_snapshot& snapshot, const host_filter& filter) const
+{
+	if (!_map)
+		return false;
+	madvise(_map, _size, MADV_SEQUENTIAL);
+	return snapshot.read_image(static_cast<const char*>(_map) + sizeof(header), _size - sizeof(header), filter);
+}
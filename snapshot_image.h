@@ -0,0 +1,35 @@
+#ifndef __SNAPSHOT_IMAGE_H
+#define __SNAPSHOT_IMAGE_H
+
+#include <cstddef>
+#include <string>
+
+#include "host_filter.h"
+#include "nagios_snapshot.h"
+
+// A snapshot published by the watch mode, usually on tmpfs, for CGI
+// processes to map instead of parsing the Nagios files. A new image is
+// written aside then renamed over the old one: readers never lock, and keep
+// the image they mapped for as long as they need it. The image records the
+// generation of the source files it was built from, so that one left behind
+// by a stopped updater is not served once Nagios has moved on.
+class snapshot_image
+{
+private:
+	struct header;
+
+	void* _map;
+	std::size_t _size;
+
+public:
+	snapshot_image() : _map(nullptr), _size(0) { }
+	~snapshot_image();
+
+	static bool publish(const std::string& path, const std::string& generation, const nagios_snapshot& snapshot);
+
+	// Maps path if it holds a complete image of this generation.
+	bool open(const std::string& path, const std::string& generation);
+	bool load(nagios_snapshot& snapshot, const host_filter& filter) const;
+};
+
+#endif
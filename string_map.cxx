@@ -1,5 +1,6 @@
 #include "globals.h"
 
+#include <cctype>
 #include <istream>
 #include <map>
 #include <string>
@@ -49,3 +50,47 @@ void parse_string_map(string_map& environment, istream& envs)
 			parse_string_pair(environment, s);
 	}
 }
+
+namespace
+{
+	string url_decode(const string& s)
+	{
+		string decoded;
+		decoded.reserve(s.size());
+		string::size_type size = s.size();
+		for (string::size_type i(0); i < size; ++i)
+		{
+			char c = s[i];
+			if (c == '+')
+				decoded.push_back(' ');
+			else if (c == '%' && i + 2 < size && isxdigit(s[i + 1]) && isxdigit(s[i + 2]))
+			{
+				decoded.push_back(static_cast<char>(stoi(s.substr(i + 1, 2), nullptr, 16)));
+				i += 2;
+			}
+			else
+				decoded.push_back(c);
+		}
+		return decoded;
+	}
+}
+
+void parse_query_string(string_map& parameters, const string& query)
+{
+	string::size_type pos = 0;
+	while (pos <= query.size())
+	{
+		string::size_type end = query.find('&', pos);
+		if (end == string::npos)
+			end = query.size();
+		string pair(query.substr(pos, end - pos));
+		pos = end + 1;
+		if (!pair.size())
+			continue;
+		string::size_type eq = pair.find('=');
+		if (eq == string::npos)
+			parameters.insert(make_pair(url_decode(pair), string()));
+		else
+			parameters.insert(make_pair(url_decode(pair.substr(0, eq)), url_decode(pair.substr(eq + 1))));
+	}
+}
@@ -11,5 +11,7 @@ void parse_string_pair(string_map& environment, const std::string& row);
 
 void parse_string_map(string_map& environment, char** envp);
 void parse_string_map(string_map& environment, std::istream& envs);
+// name=value&name2&name3=value3, with + and %XX decoded
+void parse_query_string(string_map& parameters, const std::string& query);
 
 #endif
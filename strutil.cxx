@@ -1,6 +1,11 @@
 #include "globals.h"
 
 #include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <string>
 
 #include "strutil.h"
@@ -9,6 +14,8 @@ using namespace std;
 
 void trim(string& s)
 {
+	if (s.empty())
+		return;
 	string::size_type start = 0;
 	while (s.size() > start && isspace(s[start]))
 		++start;
@@ -22,6 +29,7 @@ void trim(string& s)
 bool getnumber(string::const_iterator& begin, const string::const_iterator& end, double& value)
 {
 	char c;
+	string::const_iterator start(begin);
 	if (begin != end && ((c = *begin) == '.' || c == ',' || c == '-' || isdigit(c)))
 	{
 		string num;
@@ -30,12 +38,109 @@ bool getnumber(string::const_iterator& begin, const string::const_iterator& end,
 			num.push_back((c == ',') ? '.' : c);
 			++begin;
 		} while (begin != end && ((c = *begin) == '.' || c == ',' || isdigit(c)));
-		value = stod(num);
-		return true;
+		// An exponent only with digits, so that a unit may start with e.
+		string::const_iterator exponent(begin);
+		if (exponent != end && (*exponent == 'e' || *exponent == 'E'))
+		{
+			++exponent;
+			if (exponent != end && (*exponent == '+' || *exponent == '-'))
+				++exponent;
+			if (exponent != end && isdigit(*exponent))
+			{
+				num.append(begin, exponent);
+				for (begin = exponent; begin != end && isdigit(*begin); ++begin)
+					num.push_back(*begin);
+			}
+		}
+		// A lone sign or point fails, as does a value out of the range of a
+		// double, which has no JSON spelling.
+		char* parsed;
+		errno = 0;
+		value = strtod(num.c_str(), &parsed);
+		if (parsed != num.c_str() && errno != ERANGE)
+			return true;
+		begin = start;
 	}
 	return false;
 }
+bool getinteger(const string& s, int& value)
+{
+	char* parsed;
+	errno = 0;
+	long l = strtol(s.c_str(), &parsed, 10);
+	if (parsed == s.c_str() || errno == ERANGE || l < INT_MIN || l > INT_MAX)
+		return false;
+	value = static_cast<int>(l);
+	return true;
+}
+bool getinteger(const string& s, long long& value)
+{
+	char* parsed;
+	errno = 0;
+	long long ll = strtoll(s.c_str(), &parsed, 10);
+	if (parsed == s.c_str() || errno == ERANGE)
+		return false;
+	value = ll;
+	return true;
+}
 bool starts_with(const string& haystack, const string& needle)
 {
 	return haystack.size() >= needle.size() && haystack.compare(0, needle.size(), needle) == 0;
-}
\ No newline at end of file
+}
+uint64_t hash_string(const string& s)
+{
+	uint64_t hash = 14695981039346656037ULL;
+	string::const_iterator end = s.end();
+	for (string::const_iterator it = s.begin(); it != end; ++it)
+	{
+		hash ^= static_cast<unsigned char>(*it);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+namespace
+{
+	const char base64url_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+}
+string base64url_encode(const string& s)
+{
+	string encoded;
+	encoded.reserve((s.size() + 2) / 3 * 4);
+	uint32_t bits = 0;
+	int count = 0;
+	string::const_iterator end = s.end();
+	for (string::const_iterator it = s.begin(); it != end; ++it)
+	{
+		bits = (bits << 8) | static_cast<unsigned char>(*it);
+		count += 8;
+		while (count >= 6)
+		{
+			count -= 6;
+			encoded.push_back(base64url_alphabet[(bits >> count) & 0x3F]);
+		}
+	}
+	if (count > 0)
+		encoded.push_back(base64url_alphabet[(bits << (6 - count)) & 0x3F]);
+	return encoded;
+}
+bool base64url_decode(const string& s, string& decoded)
+{
+	decoded.clear();
+	uint32_t bits = 0;
+	int count = 0;
+	string::const_iterator end = s.end();
+	for (string::const_iterator it = s.begin(); it != end; ++it)
+	{
+		const char* p = strchr(base64url_alphabet, *it);
+		if (!*it || !p)
+			return false;
+		bits = (bits << 6) | static_cast<uint32_t>(p - base64url_alphabet);
+		count += 6;
+		if (count >= 8)
+		{
+			count -= 8;
+			decoded.push_back(static_cast<char>((bits >> count) & 0xFF));
+		}
+	}
+	return true;
+}
@@ -1,10 +1,18 @@
 #ifndef __STRUTIL_H
 #define __STRUTIL_H
 
+#include <cstdint>
 #include <string>
 
 void trim(std::string& s);
+// Reads a number at begin, moving past it; false, leaving begin, if none is.
 bool getnumber(std::string::const_iterator& begin, const std::string::const_iterator& end, double& value);
+// The integer s starts with, as stoi() reads it, but false where it throws.
+bool getinteger(const std::string& s, int& value);
+bool getinteger(const std::string& s, long long& value);
 bool starts_with(const std::string& haystack, const std::string& needle);
+uint64_t hash_string(const std::string& s);
+std::string base64url_encode(const std::string& s);
+bool base64url_decode(const std::string& s, std::string& decoded);
 
 #endif
\ No newline at end of file